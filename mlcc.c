@@ -29,30 +29,57 @@
 //
 
 
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <ftw.h>
 #include <getopt.h>
+#include <libgen.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
 
 int gui = 0;
 int debug = 0;
+int fetch = 0;
+int manifest = 0;
 int quiet = 0;
+int apptainer = 0;
+char *lazy_pull = NULL;
+char *batch_file = NULL;
+int shard_index = 1;
+int shard_count = 1;
+int regen = 0;
+int slim = 0;
+int tf_verbs = 0;
+int tf_xla = 0;
+char *cpu_arch = NULL;
+int timing = 0;
+int toolchain_images = 0;
 int verbose = 0;
 int num_cpus = 0;
+int inference = 0;
 int interactive = 0;
 char *prog_name = NULL;
 char *list_delimiters = " \t,";
 char *output_file_name = NULL;
 char *title_string = "Machine Learning Container Creator";
 char *version_string = "20180606c";
+char *source_dir = "MLCC_Repos/SOURCES";
 
 
 void display_version_and_exit() {
@@ -62,17 +89,43 @@ void display_version_and_exit() {
 
 
 void display_usage_and_exit() {
+    fprintf(stderr, "build [-j <n>] [--builder docker|podman|buildah|<cmd>] [--context <dir>] [--load <n>] [--memory <GB>] [--logs <dir>] <Dockerfile>...\n");
+    fprintf(stderr, "    as the first arg, to build generated Dockerfiles in dependency order, see build_main()\n");
+    fprintf(stderr, "catalog <out> <file>...\n");
+    fprintf(stderr, "    as the first arg, to compile pkg data files into a catalog, see catalog_main()\n");
+    fprintf(stderr, "--apptainer to also write an Apptainer definition file (<output>.def) for a SIF image\n");
+    fprintf(stderr, "--batch <file> to write a Dockerfile into the -o dir for each -i style line of file\n");
+    fprintf(stderr, "--catalog <file> to add the pkgs of a compiled catalog (also $MLCC_CATALOG)\n");
+    fprintf(stderr, "--cpu-arch <march> to set the gcc -march for source builds (PyTorch-src, TensorFlow)\n");
+    fprintf(stderr, "--cuda-arch <cap>,<cap>... to set the CUDA compute capabilities built for (default 5.2,6.0,6.1,7.0)\n");
+    fprintf(stderr, "--cuda-ptx <yes|no> to add PTX for the highest CUDA arch as a JIT fallback (default yes)\n");
+    fprintf(stderr, "--import-budget <ms> to fail the build when an import check takes longer\n");
+    fprintf(stderr, "--inference to end with a slim runtime stage holding just TF-Serving/ONNX-Runtime\n");
+    fprintf(stderr, "--lazy-pull <estargz|zstd:chunked> to also write <output>.build.sh building a lazily pulled image\n");
+    fprintf(stderr, "--python-pgo-task <args> to set the PGO training run of a source built Python\n");
+    fprintf(stderr, "--python-profile <profile> to set the source built Python profile (pgo, lto-pgo or fast)\n");
+    fprintf(stderr, "--regen <Dockerfile>... to rewrite each from its # mlcc -i pkgs and options when that changes it\n");
+    fprintf(stderr, "--shard <i>/<N> to write only shard i of N of a --batch, balanced by build cost\n");
+    fprintf(stderr, "--slim to strip, and drop static libs, objects, tests and caches, in each pkg layer\n");
+    fprintf(stderr, "--stages to build the from-source pkgs in concurrent BuildKit stages, merged at the end\n");
+    fprintf(stderr, "--tf-verbs to build TensorFlow with verbs (and GPUDirect RDMA with CUDA)\n");
+    fprintf(stderr, "--tf-xla to build TensorFlow with the XLA JIT\n");
     fprintf(stderr, "-d to turn on debugging output\n");
+    fprintf(stderr, "-F to fetch the source artifacts of selected (or all) pkgs into %s\n", source_dir);
+    fprintf(stderr, "-g <profile> to set the GCC-x.y build profile (fast, fortran or full)\n");
     fprintf(stderr, "-G to use the GUI selection interface\n");
     fprintf(stderr, "-h to see this usage help message\n");
     fprintf(stderr, "-i <pkg>,<pkg>... to generate a dockerfile with specified pkgs\n");
     fprintf(stderr, "-I to use the interactive selection interface\n");
     fprintf(stderr, "-l to see a display of all pkg names\n");
+    fprintf(stderr, "-m to record per-pkg build times in /etc/mlcc/build-times\n");
+    fprintf(stderr, "-M to see the source manifest of selected (or all) pkgs\n");
     fprintf(stderr, "-o <output file name> to set output file name\n");
     fprintf(stderr, "-q to turn on quiet mode\n");
     fprintf(stderr, "-t <text> to set the GUI window title string\n");
+    fprintf(stderr, "-T to write toolchain Dockerfiles and COPY the toolchains from their images\n");
     fprintf(stderr, "-V to show the %s code version\n", prog_name);
-    fprintf(stderr, "-v to turn on verbose mode\n");
+    fprintf(stderr, "-v to turn on verbose mode (and tally the build context each .dockerignore leaves)\n");
     exit(EXIT_FAILURE);
 }
 
@@ -85,6 +138,10 @@ void display_usage_and_exit() {
 #define PYTHON_LO_PO_NUM_START 200
 #define PYTHON_HI_PO_NUM_LIMIT 300
 #define MISC_LO_PO_NUM_START   500
+#define PARALLEL_LO_PO_NUM_START 650
+#define INPUT_LO_PO_NUM_START  700
+#define INFERENCE_LO_PO_NUM_START 800
+#define PROFILING_LO_PO_NUM_START 900
 #define MAX_PO_NUM_LIMIT     10000
 
 
@@ -94,7 +151,7 @@ struct pkg_data {
     char *label;
     char *desc;
     char *frag;
-} pkgs[] = {
+} builtin_pkgs[] = {
 
 
 //
@@ -175,8 +232,19 @@ yum clean all; yum -y update; cd /var/cache && /bin/rm -rf dnf yum
 yum clean all; yum -y update; cd /var/cache && /bin/rm -rf dnf yum
 ) },
 
-// FIXME: specific version of cmake
-{ 50, 0, "OS-Utils", "OS Utils", BS( RUN
+//
+// Besides yum_install.sh, this sets up the source fetch helpers, and the
+// mlcc_slim.sh cleanup --slim ends each pkg layer with.  Built with
+// "--build-arg MLCC_MIRROR=http://<host>:<port>" pointing at a served copy of
+// the store filled by "mlcc -F", artifacts come from that mirror and are
+// checked against its SHA256SUMS.  Without it (or on a mirror miss) they come
+// from upstream, checked against the sums pinned in the store when the
+// Dockerfile was written (see write_pinned_checksums()).  Git sources are
+// always shallow clones of a pinned ref.
+//
+{ 50, 0, "OS-Utils", "OS Utils", BS(
+ARG MLCC_MIRROR
+\nRUN
 echo -e '\
 #!/bin/bash \n\
 set -vx \n\
@@ -196,9 +264,84 @@ for (( TRY=1; TRY<=11; TRY++ )); do \n\
 done \n\
 exit 1 \n'
 >> /tmp/yum_install.sh;
-chmod +x /tmp/yum_install.sh;
+echo -e '\
+#!/bin/bash \n\
+URL="$1" \n\
+FILE="${2:-${URL##*/}}" \n\
+check() { \n\
+    while read SUM NAME; do \n\
+        if [ "$NAME" == "$FILE" ]; then \n\
+            echo "$SUM  $FILE" | sha256sum -c - \n\
+            return \n\
+        fi \n\
+    done \n\
+    return 2 \n\
+} \n\
+if [ -n "$MLCC_MIRROR" ]; then \n\
+    if wget -q -O "$FILE" "$MLCC_MIRROR/$FILE" && \n\
+       wget -q -O - "$MLCC_MIRROR/SHA256SUMS" | check; then \n\
+        exit 0 \n\
+    fi \n\
+    /bin/rm -f "$FILE" \n\
+    echo "mlcc mirror miss for $FILE" \n\
+fi \n\
+[ "$URL" != "-" ] && wget -q -O "$FILE" "$URL" || exit 1 \n\
+check < /tmp/mlcc_sha256sums \n\
+result=$? \n\
+if (( result == 2 )); then \n\
+    echo "mlcc has no pinned checksum for $FILE" \n\
+    exit 0 \n\
+fi \n\
+(( result == 0 )) || /bin/rm -f "$FILE" \n\
+exit $result \n'
+>> /tmp/mlcc_fetch.sh;
+echo -e '\
+#!/bin/bash \n\
+URL="$1" \n\
+REF="$2" \n\
+DIR="$3" \n\
+shift 3 \n\
+NAME="$(basename $URL .git)-$REF.tar.gz" \n\
+if (cd /tmp && /tmp/mlcc_fetch.sh - "$NAME"); then \n\
+    mkdir -p "$DIR" && tar -xzf "/tmp/$NAME" -C "$DIR" \n\
+    result=$? \n\
+    /bin/rm -f "/tmp/$NAME" \n\
+    exit $result \n\
+fi \n\
+git clone --depth 1 --branch "$REF" "$@" "$URL" "$DIR" \n'
+>> /tmp/mlcc_git_clone.sh;
+echo -e '\
+#!/bin/bash \n\
+DIRS="/usr/local /opt /root" \n\
+[ -f /tmp/mlcc_slim.stamp ] && NEWER="-cnewer /tmp/mlcc_slim.stamp" \n\
+JUNK=( "(" -name "*.a" -o -name "*.o" -o -name "*.pyo" -o -name "*.opt-[12].pyc" ")" \n\
+    ! -regex ".*/gcc/.*" ! -regex ".*/cuda[^/]*/.*" ! -regex ".*/config-[^/]*/.*" ) \n\
+files() { find $DIRS -xdev $NEWER "$@" -print0 2>/dev/null; } \n\
+total() { local s=0 n rest; while read n rest; do (( s += n )); done; echo $s; } \n\
+measure() { du -sxb $DIRS /var/cache 2>/dev/null | total; } \n\
+[ "$MLCC_SLIM_MEASURE" == "1" ] && BEFORE=$(measure) \n\
+EST=$(files -type f "${JUNK[@]}" | xargs -0 -r stat -c %s | total) \n\
+files -type f "${JUNK[@]}" | xargs -0 -r /bin/rm -f \n\
+(( EST += $(files -type d -regex ".*/site-packages/.*/tests" -prune | xargs -0 -r du -sb | total) )) \n\
+files -type d -regex ".*/site-packages/.*/tests" -prune | xargs -0 -r /bin/rm -rf \n\
+(( EST += $(du -sb /root/.cache/pip /var/cache/yum /var/cache/dnf 2>/dev/null | total) )) \n\
+/bin/rm -rf /root/.cache/pip /var/cache/yum /var/cache/dnf \n\
+while read -d "" SO; do \n\
+    SIZE=$(stat -c %s "$SO") \n\
+    strip --strip-unneeded "$SO" 2>/dev/null && (( EST += SIZE - $(stat -c %s "$SO") )) \n\
+done < <(files -type f -name "*.so*" ! -regex ".*/cuda[^/]*/.*") \n\
+[ -n "$BEFORE" ] && MEASURED=$(( BEFORE - $(measure) )) \n\
+echo "mlcc slim $1: estimated $EST bytes${MEASURED:+, measured $MEASURED bytes}" \n\
+mkdir -p /etc/mlcc && echo "$1 $EST $MEASURED" >> /etc/mlcc/slim-bytes \n\
+touch /tmp/mlcc_slim.stamp \n'
+>> /tmp/mlcc_slim.sh;
+chmod +x /tmp/yum_install.sh /tmp/mlcc_fetch.sh /tmp/mlcc_git_clone.sh /tmp/mlcc_slim.sh;
 /tmp/yum_install.sh bzip2 findutils gcc gcc-c++ gcc-gfortran git gzip make patch pciutils unzip vim-enhanced wget xz zip;
-cd /tmp && wget "https://cmake.org/files/v3.11/cmake-3.11.3.tar.gz" && tar -xf cmake*.gz;
+) },
+
+// FIXME: specific version of cmake
+{ 50, 0, "CMake", "CMake 3.11.3", BS( RUN
+cd /tmp && /tmp/mlcc_fetch.sh "https://cmake.org/files/v3.11/cmake-3.11.3.tar.gz" && tar -xf cmake*.gz;
 cd /tmp/cmake-3.11.3 && ./bootstrap && make -j`getconf _NPROCESSORS_ONLN` && make install;
 cd /tmp && /bin/rm -rf /tmp/cmake*;
 cmake --version
@@ -474,6 +617,11 @@ LD_LIBRARY_PATH="/usr/local/cuda/lib64:/usr/local/lib:${LD_LIBRARY_PATH:+:${LD_L
 // FIXME: Specific versions
 // For building, see: "https://danieleriksson.net/2017/02/08/how-to-install-latest-python-on-centos"
 //
+// When there is no system Python, these build it with the configure options
+// of the selected python_profiles[] entry (MLCC_PYTHON_CONFIGURE_OPTS) and the
+// --cpu-arch march.  MLCC_PYTHON_PROFILE_TASK, when set, replaces the PGO
+// training run.
+//
 
 { 250, 0, "Python2", "Python2", BS( RUN
 cd /usr/local && /bin/rm -rf lib64 && ln -s lib lib64;
@@ -484,10 +632,11 @@ if [ -x /usr/bin/python2 ]; then
 else
     /tmp/yum_install.sh bzip2-devel libdb4-devel expat-devel gdbm-devel libpcap-devel
     ncurses-devel openssl-devel readline-devel sqlite-devel tk-devel xz-devel zlib-devel;
-    cd /tmp && wget "https://www.python.org/ftp/python/2.7.15/Python-2.7.15.tar.xz" && tar -xf Python*.xz;
+    cd /tmp && /tmp/mlcc_fetch.sh "https://www.python.org/ftp/python/2.7.15/Python-2.7.15.tar.xz" && tar -xf Python*.xz;
     cd /tmp/Python-2.7.15 &&
-    ./configure --enable-optimizations --enable-shared --enable-unicode=ucs4 --prefix=/usr/local --with-ensurepip=install LDFLAGS="-Wl,-rpath /usr/local/lib" &&
-    make -j`getconf _NPROCESSORS_ONLN` && make install;
+    ./configure $MLCC_PYTHON_CONFIGURE_OPTS --enable-shared --enable-unicode=ucs4 --prefix=/usr/local --with-ensurepip=install
+        LDFLAGS="-Wl,-rpath /usr/local/lib" ${MLCC_CPU_ARCH:+CFLAGS=-march=$MLCC_CPU_ARCH} &&
+    make -j`getconf _NPROCESSORS_ONLN` ${MLCC_PYTHON_PROFILE_TASK:+PROFILE_TASK="$MLCC_PYTHON_PROFILE_TASK"} && make install;
     cp -a /usr/local/include/python* /usr/include/;
 fi;
 cd /var/cache && /bin/rm -rf dnf yum;
@@ -502,10 +651,11 @@ if [ -x /usr/bin/python3 ]; then
 else
     /tmp/yum_install.sh bzip2-devel libdb4-devel expat-devel gdbm-devel libpcap-devel
     ncurses-devel openssl-devel readline-devel sqlite-devel tk-devel xz-devel zlib-devel;
-    cd /tmp && wget "https://www.python.org/ftp/python/3.6.5/Python-3.6.5.tar.xz" && tar -xf Python*.xz;
+    cd /tmp && /tmp/mlcc_fetch.sh "https://www.python.org/ftp/python/3.6.5/Python-3.6.5.tar.xz" && tar -xf Python*.xz;
     cd /tmp/Python-3.6.5 &&
-    ./configure --enable-optimizations --enable-shared --prefix=/usr/local --with-ensurepip=install LDFLAGS="-Wl,-rpath /usr/local/lib" &&
-    make -j`getconf _NPROCESSORS_ONLN` && make install;
+    ./configure $MLCC_PYTHON_CONFIGURE_OPTS --enable-shared --prefix=/usr/local --with-ensurepip=install
+        LDFLAGS="-Wl,-rpath /usr/local/lib" ${MLCC_CPU_ARCH:+CFLAGS=-march=$MLCC_CPU_ARCH} &&
+    make -j`getconf _NPROCESSORS_ONLN` ${MLCC_PYTHON_PROFILE_TASK:+PROFILE_TASK="$MLCC_PYTHON_PROFILE_TASK"} && make install;
     cp -a /usr/local/include/python* /usr/include/;
     cd /usr/local/bin && ln -s python3.6 python && ln -s pip3.6 pip;
 fi;
@@ -524,6 +674,9 @@ pip install --upgrade pip setuptools;
 //
 // See Nvidia nvcc gcc supported versions: "https://docs.nvidia.com/cuda/cuda-installation-guide-linux/index.html"
 //
+// These GCCs are only the nvcc host compiler.  MLCC_GCC_CONFIGURE_OPTS is an
+// ARG written ahead of them from the selected gcc_profiles[] entry.
+//
 
 
 #if INCLUDE_GCC_5_3
@@ -531,11 +684,11 @@ pip install --upgrade pip setuptools;
 { 600, 0, "GCC-5.3", "Old GCC 5.3", BS( RUN 
 mkdir -p /tmp/gcc_tmp_build_dir;
 cd /tmp/gcc_tmp_build_dir;
-wget -q "https://ftp.gnu.org/gnu/gcc/gcc-5.3.0/gcc-5.3.0.tar.gz";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.16.1.tar.bz2";
+/tmp/mlcc_fetch.sh "https://ftp.gnu.org/gnu/gcc/gcc-5.3.0/gcc-5.3.0.tar.gz";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.16.1.tar.bz2";
 tar -xf gcc-5.3.0.tar.gz;
 tar -xf gmp-6.1.0.tar.bz2;
 tar -xf mpfr-3.1.4.tar.bz2;
@@ -545,9 +698,9 @@ ln -s /tmp/gcc_tmp_build_dir/gmp-6.1.0 gcc-5.3.0/gmp;
 ln -s /tmp/gcc_tmp_build_dir/mpfr-3.1.4 gcc-5.3.0/mpfr;
 ln -s /tmp/gcc_tmp_build_dir/mpc-1.0.3 gcc-5.3.0/mpc;
 ln -s /tmp/gcc_tmp_build_dir/isl-0.16.1 gcc-5.3.0/isl;
-wget -qO gcc_patch.txt 'https://gcc.gnu.org/git/?p=gcc.git;a=patch;h=ec1cc0263f156f70693a62cf17b254a0029f4852';
-patch -p1 -d gcc-5.3.0 < gcc_patch.txt;
-gcc-5.3.0/configure --disable-multilib --enable-languages=c,c++,fortran --prefix=/usr/local;
+/tmp/mlcc_fetch.sh 'https://gcc.gnu.org/git/?p=gcc.git;a=patch;h=ec1cc0263f156f70693a62cf17b254a0029f4852' gcc-5.3.0-ec1cc026.patch;
+patch -p1 -d gcc-5.3.0 < gcc-5.3.0-ec1cc026.patch;
+gcc-5.3.0/configure $MLCC_GCC_CONFIGURE_OPTS --prefix=/usr/local;
 make -j`getconf _NPROCESSORS_ONLN`;
 make install-strip;
 cd /tmp && /bin/rm -rf /tmp/gcc_tmp_build_dir
@@ -561,11 +714,11 @@ CXX="/usr/local/bin/g++"
 { 600, 0, "GCC-5.5", "Old GCC 5.5", BS( RUN 
 mkdir -p /tmp/gcc_tmp_build_dir;
 cd /tmp/gcc_tmp_build_dir;
-wget -q "https://ftp.gnu.org/gnu/gcc/gcc-5.5.0/gcc-5.5.0.tar.gz";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2";
+/tmp/mlcc_fetch.sh "https://ftp.gnu.org/gnu/gcc/gcc-5.5.0/gcc-5.5.0.tar.gz";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2";
 tar -xf gcc-5.5.0.tar.gz;
 tar -xf gmp-6.1.0.tar.bz2;
 tar -xf mpfr-3.1.4.tar.bz2;
@@ -575,7 +728,7 @@ ln -s /tmp/gcc_tmp_build_dir/gmp-6.1.0 gcc-5.5.0/gmp;
 ln -s /tmp/gcc_tmp_build_dir/mpfr-3.1.4 gcc-5.5.0/mpfr;
 ln -s /tmp/gcc_tmp_build_dir/mpc-1.0.3 gcc-5.5.0/mpc;
 ln -s /tmp/gcc_tmp_build_dir/isl-0.18 gcc-5.5.0/isl;
-gcc-5.5.0/configure --disable-multilib --enable-languages=c,c++,fortran --prefix=/usr/local;
+gcc-5.5.0/configure $MLCC_GCC_CONFIGURE_OPTS --prefix=/usr/local;
 make -j`getconf _NPROCESSORS_ONLN`;
 make install-strip;
 cd /tmp && /bin/rm -rf /tmp/gcc_tmp_build_dir
@@ -589,11 +742,11 @@ CXX="/usr/local/bin/g++"
 { 600, 0, "GCC-6.3", "Old GCC 6.3", BS( RUN 
 mkdir -p /tmp/gcc_tmp_build_dir;
 cd /tmp/gcc_tmp_build_dir;
-wget -q "https://ftp.gnu.org/gnu/gcc/gcc-6.3.0/gcc-6.3.0.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2";
+/tmp/mlcc_fetch.sh "https://ftp.gnu.org/gnu/gcc/gcc-6.3.0/gcc-6.3.0.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2";
 tar -xf gcc-6.3.0.tar.bz2;
 tar -xf gmp-6.1.0.tar.bz2;
 tar -xf mpfr-3.1.4.tar.bz2;
@@ -603,7 +756,7 @@ ln -s /tmp/gcc_tmp_build_dir/gmp-6.1.0 gcc-6.3.0/gmp;
 ln -s /tmp/gcc_tmp_build_dir/mpfr-3.1.4 gcc-6.3.0/mpfr;
 ln -s /tmp/gcc_tmp_build_dir/mpc-1.0.3 gcc-6.3.0/mpc;
 ln -s /tmp/gcc_tmp_build_dir/isl-0.18 gcc-6.3.0/isl;
-gcc-6.3.0/configure --disable-multilib --enable-languages=c,c++,fortran --prefix=/usr/local;
+gcc-6.3.0/configure $MLCC_GCC_CONFIGURE_OPTS --prefix=/usr/local;
 make -j`getconf _NPROCESSORS_ONLN`;
 make install-strip;
 cd /tmp && /bin/rm -rf /tmp/gcc_tmp_build_dir
@@ -618,11 +771,11 @@ CXX="/usr/local/bin/g++"
 { 600, 0, "GCC-6.4", "Old GCC 6.4", BS( RUN 
 mkdir -p /tmp/gcc_tmp_build_dir;
 cd /tmp/gcc_tmp_build_dir;
-wget -q "https://ftp.gnu.org/gnu/gcc/gcc-6.4.0/gcc-6.4.0.tar.xz";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2";
+/tmp/mlcc_fetch.sh "https://ftp.gnu.org/gnu/gcc/gcc-6.4.0/gcc-6.4.0.tar.xz";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2";
 tar -xf gcc-6.4.0.tar.xz;
 tar -xf gmp-6.1.0.tar.bz2;
 tar -xf mpfr-3.1.4.tar.bz2;
@@ -632,7 +785,7 @@ ln -s /tmp/gcc_tmp_build_dir/gmp-6.1.0 gcc-6.4.0/gmp;
 ln -s /tmp/gcc_tmp_build_dir/mpfr-3.1.4 gcc-6.4.0/mpfr;
 ln -s /tmp/gcc_tmp_build_dir/mpc-1.0.3 gcc-6.4.0/mpc;
 ln -s /tmp/gcc_tmp_build_dir/isl-0.18 gcc-6.4.0/isl;
-gcc-6.4.0/configure --disable-multilib --enable-languages=c,c++,fortran --prefix=/usr/local;
+gcc-6.4.0/configure $MLCC_GCC_CONFIGURE_OPTS --prefix=/usr/local;
 make -j`getconf _NPROCESSORS_ONLN`;
 make install-strip;
 cd /tmp && /bin/rm -rf /tmp/gcc_tmp_build_dir
@@ -646,11 +799,11 @@ CXX="/usr/local/bin/g++"
 { 600, 0, "GCC-7.3", "Old GCC 7.3", BS( RUN 
 mkdir -p /tmp/gcc_tmp_build_dir;
 cd /tmp/gcc_tmp_build_dir;
-wget -q "https://ftp.gnu.org/gnu/gcc/gcc-7.3.0/gcc-7.3.0.tar.xz";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
-wget -q "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2";
+/tmp/mlcc_fetch.sh "https://ftp.gnu.org/gnu/gcc/gcc-7.3.0/gcc-7.3.0.tar.xz";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz";
+/tmp/mlcc_fetch.sh "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2";
 tar -xf gcc-7.3.0.tar.xz;
 tar -xf gmp-6.1.0.tar.bz2;
 tar -xf mpfr-3.1.4.tar.bz2;
@@ -660,7 +813,7 @@ ln -s /tmp/gcc_tmp_build_dir/gmp-6.1.0 gcc-7.3.0/gmp;
 ln -s /tmp/gcc_tmp_build_dir/mpfr-3.1.4 gcc-7.3.0/mpfr;
 ln -s /tmp/gcc_tmp_build_dir/mpc-1.0.3 gcc-7.3.0/mpc;
 ln -s /tmp/gcc_tmp_build_dir/isl-0.18 gcc-7.3.0/isl;
-gcc-7.3.0/configure --disable-multilib --enable-languages=c,c++,fortran --prefix=/usr/local;
+gcc-7.3.0/configure $MLCC_GCC_CONFIGURE_OPTS --prefix=/usr/local;
 make -j`getconf _NPROCESSORS_ONLN`;
 make install-strip;
 cd /tmp && /bin/rm -rf /tmp/gcc_tmp_build_dir
@@ -684,7 +837,7 @@ yum -y install intel-mkl-64bit-2018.2-046; cd /var/cache && /bin/rm -rf dnf yum
 // See: "https://github.com/intel/mkl-dnn"
 // See: "https://software.intel.com/en-us/articles/intel-mkl-dnn-part-1-library-overview-and-installation"
 { 600, 0, "MKL-DNN", "MKL-DNN", BS( RUN
-cd /tmp && git clone "https://github.com/intel/mkl-dnn.git";
+cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/intel/mkl-dnn.git" v0.14 mkl-dnn;
 cd /tmp/mkl-dnn/scripts && ./prepare_mkl.sh;
 mkdir -p /tmp/mkl-dnn/build &&
 cd /tmp/mkl-dnn/build &&
@@ -723,15 +876,78 @@ pip install numpy
 
 #endif
 
+// MLCC_TF_MKL, MLCC_TF_XLA and MLCC_TF_BUILD are ARGs written ahead of this
+// fragment (see write_tensorflow_args()).  "mlcc_tf_bench --compare" in the
+// image compares CPU matmul/conv2d throughput with the stock TF wheel.
+//
 // FIXME: Need to tune environment variables and options for microarchitecture and desire for MKL, etc.
 // -c opt --copt=-mavx --copt=-mavx2 --copt=-mfma --copt=-mfpmath=both --copt=-msse4.1 --copt=-msse4.2 --config=cuda --config=mkl 
 
 // /tmp/yum_install.sh golang java-1.8.0-openjdk java-1.8.0-openjdk-devel java-1.8.0-openjdk-headless;
 // echo "#define _BITS_FLOATN_H" >> /usr/local/cuda/include/host_defines.h
 
-{ 600, 0, "TensorFlow", "TensorFlow", BS( RUN 
+//
+// CUDA-aware (when CUDA is there) Open MPI with verbs, for Horovod, TensorFlow
+// (MLCC_TF_MPI) and mpi4py.  "mlcc_allreduce_bench [np]" in the image runs an
+// mpi4py allreduce bandwidth sweep on np local ranks (default 4), no GPU or
+// network needed.
+//
+{ 600, 0, "OpenMPI", "Open MPI 3.1.2", BS( RUN
+/tmp/yum_install.sh rdma-core-devel;
+cd /tmp && /tmp/mlcc_fetch.sh "https://download.open-mpi.org/release/open-mpi/v3.1/openmpi-3.1.2.tar.bz2" && tar -xf openmpi-3.1.2.tar.bz2;
+cd /tmp/openmpi-3.1.2 &&
+./configure --prefix=/usr/local --with-verbs `[ -d /usr/local/cuda ] && echo --with-cuda=/usr/local/cuda` &&
+make -j`getconf _NPROCESSORS_ONLN` && make install &&
+ldconfig;
+cd /tmp && /bin/rm -rf /tmp/openmpi*;
+ompi_info --parsable --all | grep mpi_built_with_cuda_support:value;
+pip install mpi4py;
+echo -e '\
+import time \n\
+import numpy as np \n\
+from mpi4py import MPI \n\
+comm = MPI.COMM_WORLD \n\
+rank = comm.Get_rank() \n\
+size = comm.Get_size() \n\
+if rank == 0: \n\
+    print("allreduce float32, %d ranks" % size) \n\
+    print("%12s %10s %12s" % ("bytes", "usec", "busbw GB/s")) \n\
+for shift in range(10, 27, 2): \n\
+    n = (1 << shift) // 4 \n\
+    a = np.ones(n, dtype=np.float32) \n\
+    b = np.empty_like(a) \n\
+    iters = max(5, min(200, (1 << 28) // (n * 4))) \n\
+    comm.Allreduce(a, b) \n\
+    comm.Barrier() \n\
+    t = time.time() \n\
+    for i in range(iters): \n\
+        comm.Allreduce(a, b) \n\
+    t = comm.allreduce(time.time() - t, op=MPI.MAX) / iters \n\
+    if rank == 0: \n\
+        print("%12d %10.1f %12.2f" % (n * 4, t * 1e6, 2.0 * (size - 1) / size * n * 4 / t / 1e9)) \n'
+>> /usr/local/bin/mlcc_allreduce_bench.py;
+echo -e '\
+#!/bin/bash \n\
+mpirun --allow-run-as-root --oversubscribe --mca btl self,vader -np ${1:-4} python /usr/local/bin/mlcc_allreduce_bench.py \n'
+>> /usr/local/bin/mlcc_allreduce_bench;
+chmod +x /usr/local/bin/mlcc_allreduce_bench
+\nRUN python -c 'from mpi4py import MPI'
+) },
+
+{ 600, 0, "Bazel", "Bazel 0.12.0", BS( RUN
 /tmp/yum_install.sh java-1.8.0-openjdk java-1.8.0-openjdk-devel java-1.8.0-openjdk-headless;
+mkdir -p /tmp/bazel && cd /tmp/bazel;
+/tmp/mlcc_fetch.sh "https://github.com/bazelbuild/bazel/releases/download/0.12.0/bazel-0.12.0-dist.zip";
+unzip *.zip;
+bash ./compile.sh;
+mkdir -p /usr/local/bin && mv -f /tmp/bazel/output/bazel /usr/local/bin;
+cd /tmp && /bin/rm -rf /tmp/bazel*;
+bazel version
+) },
+
+{ 600, 0, "TensorFlow", "TensorFlow", BS( RUN 
 pip install --upgrade pip enum34 mock wheel;
+if [ "$MLCC_TF_VERBS" == "1" ]; then /tmp/yum_install.sh rdma-core-devel; fi;
 echo -e '\
 set -vx \n\
 echo $PATH \n\
@@ -756,7 +972,7 @@ if [ -d /usr/local/cuda ]; then \n\
     export CUDNN_INSTALL_PATH="/usr/local/cuda" \n\
     export NCCL_INSTALL_PATH="/usr/local/nccl" \n\
     export TF_CUDA_CLANG=0 \n\
-    export TF_CUDA_COMPUTE_CAPABILITIES="5.2,6.0,6.1,7.0" \n\
+    export TF_CUDA_COMPUTE_CAPABILITIES="${MLCC_CUDA_ARCH:-5.2,6.0,6.1,7.0}" \n\
     export TF_CUDA_VERSION=${CUDA_VERSION} \n\
     export TF_CUDNN_VERSION=${CUDNN_VERSION} \n\
     export TF_NCCL_VERSION=${NCCL_VERSION} \n\
@@ -765,35 +981,32 @@ if [ -d /usr/local/cuda ]; then \n\
 else \n\
     export TF_NEED_CUDA=0 \n\
     export MLCC_BAZEL_BUILD_OPTIONS="                     --copt=-mavx2 --copt=-mfma              " \n\
+fi \n\
+if [ "$MLCC_TF_MKL" == "1" ]; then \n\
+    export MLCC_BAZEL_BUILD_OPTIONS="$MLCC_BAZEL_BUILD_OPTIONS --config=mkl" \n\
 fi \n'
 >> /tmp/export_tf_vars.sh;
 . /tmp/export_tf_vars.sh;
 export
-CC_OPT_FLAGS="-march=native" 
-TF_DOWNLOAD_MKL=0 
-TF_ENABLE_XLA=0 
+CC_OPT_FLAGS="-march=${MLCC_CPU_ARCH:-native}" 
+MPI_HOME=/usr/local 
+TF_DOWNLOAD_MKL=${MLCC_TF_MKL:-0} 
+TF_ENABLE_XLA=${MLCC_TF_XLA:-0} 
 TF_NEED_GCP=0 
-TF_NEED_GDR=0 
+TF_NEED_GDR=${MLCC_TF_GDR:-0} 
 TF_NEED_HDFS=0 
 TF_NEED_JEMALLOC=1 
 TF_NEED_KAFKA=0 
-TF_NEED_MKL=0 
-TF_NEED_MPI=0 
+TF_NEED_MKL=${MLCC_TF_MKL:-0} 
+TF_NEED_MPI=${MLCC_TF_MPI:-0} 
 TF_NEED_OPENCL=0 
 TF_NEED_OPENCL_SYCL=0 
 TF_NEED_S3=0 
 TF_NEED_TENSORRT=0 
-TF_NEED_VERBS=0 
+TF_NEED_VERBS=${MLCC_TF_VERBS:-0} 
 TF_SET_ANDROID_WORKSPACE=0
 ;
-mkdir -p /tmp/bazel && cd /tmp/bazel;
-wget -q "https://github.com/bazelbuild/bazel/releases/download/0.12.0/bazel-0.12.0-dist.zip";
-unzip *.zip;
-bash ./compile.sh;
-mv -f /tmp/bazel/output/bazel /usr/local/bin;
-cd /tmp && /bin/rm -rf /tmp/bazel*;
-cd /tmp && git clone "https://github.com/tensorflow/tensorflow.git";
-cd /tmp/tensorflow && git checkout master;
+cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/tensorflow/tensorflow.git" v1.8.0 tensorflow;
 df -h;
 cd /tmp/tensorflow && bazel clean && ./configure;
 df -h;
@@ -808,6 +1021,41 @@ bazel-bin/tensorflow/tools/pip_package/build_pip_package /tmp/tensorflow/pip/ten
 pip install /tmp/tensorflow/pip/tensorflow_pkg/tensorflow-*_x86_64.whl;
 cd /tmp && /bin/rm -rf /tmp/tensorflow*;
 /bin/rm -rf /root/.cache/bazel* /root/.bazel*;
+mkdir -p /etc/mlcc && echo "tensorflow v1.8.0 $MLCC_TF_BUILD" > /etc/mlcc/tensorflow-build;
+echo -e '\
+import time \n\
+import tensorflow as tf \n\
+def bench(name, op, flops, iters=20): \n\
+    with tf.Session() as sess: \n\
+        sess.run(tf.global_variables_initializer()) \n\
+        sess.run(op) \n\
+        t = time.time() \n\
+        for i in range(iters): \n\
+            sess.run(op) \n\
+        t = (time.time() - t) / iters \n\
+    print("%-8s %8.1f GFLOP/s" % (name, flops / t / 1e9)) \n\
+with tf.device("/cpu:0"): \n\
+    n = 2048 \n\
+    a = tf.Variable(tf.random_normal([n, n])) \n\
+    b = tf.Variable(tf.random_normal([n, n])) \n\
+    bench("matmul", tf.reduce_sum(tf.matmul(a, b)), 2.0 * n * n * n) \n\
+    x = tf.Variable(tf.random_normal([32, 56, 56, 64])) \n\
+    w = tf.Variable(tf.random_normal([3, 3, 64, 64])) \n\
+    bench("conv2d", tf.reduce_sum(tf.nn.conv2d(x, w, [1, 1, 1, 1], "SAME")), 2.0 * 32 * 56 * 56 * 64 * 64 * 9) \n'
+>> /usr/local/bin/mlcc_tf_bench.py;
+echo -e '\
+#!/bin/bash \n\
+echo "== $(cat /etc/mlcc/tensorflow-build)" \n\
+python /usr/local/bin/mlcc_tf_bench.py \n\
+if [ "$1" == "--compare" ]; then \n\
+    pip install virtualenv && virtualenv /tmp/mlcc_stock_tf && \n\
+    /tmp/mlcc_stock_tf/bin/pip install tensorflow==1.8.0 && \n\
+    echo "== stock tensorflow 1.8.0 wheel" && \n\
+    /tmp/mlcc_stock_tf/bin/python /usr/local/bin/mlcc_tf_bench.py \n\
+    /bin/rm -rf /tmp/mlcc_stock_tf \n\
+fi \n'
+>> /usr/local/bin/mlcc_tf_bench;
+chmod +x /usr/local/bin/mlcc_tf_bench;
 \nEXPOSE 6006
 \nRUN python -c 'import tensorflow as tf'
 ) },
@@ -815,7 +1063,8 @@ cd /tmp && /bin/rm -rf /tmp/tensorflow*;
 
 { 600, 0, "Digits", "Digits", BS( # Sorry! Digits is NYI.  See: "https://developer.nvidia.com/digits" ) },
 { 600, 0, "Neon", "Neon", BS( # Sorry! neon is NYI.  See: "https://github.com/NervanaSystems/neon" ) },
-{ 600, 0, "Nnpack", "Nnpack", BS( # Sorry! nnpack is NYI.  See: "https://github.com/Maratyszcza/NNPACK" ) },
+// NNPACK comes from the PyTorch-src build, so selecting it selects that
+{ 600, 0, "Nnpack", "Nnpack", BS( # nnpack is built into PyTorch-src.  See: "https://github.com/Maratyszcza/NNPACK" ) },
 { 600, 0, "Numexpr", "Numexpr", BS( RUN pip install numexpr ) },
 { 600, 0, "Scipy", "Scipy", BS( RUN pip install scipy ) },
 { 600, 0, "Matplotlib", "Matplotlib", BS( RUN pip install matplotlib) },
@@ -829,6 +1078,57 @@ cd /tmp && /bin/rm -rf /tmp/tensorflow*;
 { 600, 0, "Cython", "Cython", BS( RUN pip install cython ) },
 { 600, 0, "OpenCV", "OpenCV", BS( RUN yum -y install opencv; cd /var/cache && /bin/rm -rf dnf yum ) },
 
+//
+// OpenCV from source: TBB threads, IPP-ICV, libjpeg-turbo, baseline SSE code
+// with AVX2/AVX-512 dispatched at run time, the CUDA modules when CUDA is
+// there (for the --cuda-arch archs) and cv2 for the selected Python.  Caffe
+// builds against it instead of the distro opencv-devel.
+// "mlcc_opencv_bench [n]" in the image reports JPEG decode/resize images/s.
+//
+{ 600, 0, "OpenCV-src", "OpenCV 3.4.3 built from source", BS( RUN
+/tmp/yum_install.sh libjpeg-turbo-devel libpng-devel libtiff-devel tbb-devel;
+PYVER=`python -c "import sys; print(sys.version_info[0])"`;
+cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/opencv/opencv.git" 3.4.3 opencv;
+mkdir -p /tmp/opencv/build && cd /tmp/opencv/build &&
+cmake ..
+    -DCMAKE_BUILD_TYPE=Release -DCMAKE_INSTALL_PREFIX=/usr/local
+    -DWITH_TBB=ON -DWITH_IPP=ON -DWITH_JPEG=ON -DBUILD_JPEG=OFF
+    -DCPU_BASELINE=SSE3 -DCPU_DISPATCH="SSE4_1;SSE4_2;AVX;FP16;AVX2;AVX512_SKX"
+    ${MLCC_CPU_ARCH:+-DCMAKE_C_FLAGS=-march=$MLCC_CPU_ARCH -DCMAKE_CXX_FLAGS=-march=$MLCC_CPU_ARCH}
+    -DWITH_CUDA=`[ -d /usr/local/cuda ] && echo ON || echo OFF`
+    ${MLCC_CUDA_ARCH_BIN:+-DCUDA_ARCH_BIN="$MLCC_CUDA_ARCH_BIN" -DCUDA_ARCH_PTX="$MLCC_CUDA_ARCH_PTX"}
+    -DBUILD_opencv_python$PYVER=ON -DPYTHON${PYVER}_EXECUTABLE=`command -v python`
+    -DBUILD_TESTS=OFF -DBUILD_PERF_TESTS=OFF -DBUILD_EXAMPLES=OFF -DBUILD_DOCS=OFF &&
+make -j`getconf _NPROCESSORS_ONLN` && make install &&
+echo "/usr/local/lib" > /etc/ld.so.conf.d/opencv.conf && ldconfig;
+cd /tmp && /bin/rm -rf /tmp/opencv;
+echo -e '\
+import sys \n\
+import time \n\
+import numpy as np \n\
+import cv2 \n\
+n = int(sys.argv[1]) if len(sys.argv) > 1 else 500 \n\
+print("opencv %s, %d threads" % (cv2.__version__, cv2.getNumThreads())) \n\
+for l in cv2.getBuildInformation().splitlines(): \n\
+    if any(k in l for k in ("Parallel framework", "Intel IPP:", "Dispatched code", "JPEG:", "NVIDIA CUDA:")): \n\
+        print(l.strip()) \n\
+img = cv2.GaussianBlur(np.random.randint(0, 256, (768, 1024, 3)).astype(np.uint8), (0, 0), 3) \n\
+jpg = cv2.imencode(".jpg", img, [cv2.IMWRITE_JPEG_QUALITY, 90])[1] \n\
+def bench(name, fn): \n\
+    fn() \n\
+    t = time.time() \n\
+    for i in range(n): \n\
+        fn() \n\
+    print("%-14s %8.1f images/s" % (name, n / (time.time() - t))) \n\
+bench("decode", lambda: cv2.imdecode(jpg, cv2.IMREAD_COLOR)) \n\
+bench("resize", lambda: cv2.resize(img, (224, 224), interpolation=cv2.INTER_AREA)) \n\
+bench("decode+resize", lambda: cv2.resize(cv2.imdecode(jpg, cv2.IMREAD_COLOR), (224, 224), interpolation=cv2.INTER_AREA)) \n'
+>> /usr/local/bin/mlcc_opencv_bench;
+sed -i "1i #!`command -v python`" /usr/local/bin/mlcc_opencv_bench;
+chmod +x /usr/local/bin/mlcc_opencv_bench
+\nRUN python -c 'import cv2'
+) },
+
 { 600, 0, "Mxnet", "Mxnet", BS( RUN
 echo -e '\
 set -vx \n\
@@ -921,10 +1221,50 @@ pip install `sh /tmp/select_pytorch.sh` torchvision
 \nRUN python -c 'import torch'
 ) },
 
+//
+// PyTorch from source, with MKL-DNN, NNPACK and the selected BLAS, for the
+// --cuda-arch archs (TORCH_CUDA_ARCH_LIST) and the --cpu-arch CPU.  MLCC_TORCH_*
+// are ARGs written ahead of this (see write_pytorch_args()).  The wheel is kept
+// in /opt/mlcc/wheels, along with a tar of it named for the build variant and
+// Python version.  Put that tar in the mlcc -F store (and its SHA256SUMS), and
+// later images of the same variant install it from MLCC_MIRROR instead of
+// rebuilding.
+//
+{ 600, 0, "PyTorch-src", "PyTorch built from source", BS( RUN
+pip install cffi pyyaml typing wheel;
+PYVER=`python -c "import sys; print(sys.version_info[0] * 10 + sys.version_info[1])"`;
+MLCC_TORCH_TAR="torch-0.4.0-$MLCC_TORCH_BUILD-py$PYVER.tar";
+mkdir -p /opt/mlcc/wheels && cd /opt/mlcc/wheels;
+if /tmp/mlcc_fetch.sh - "$MLCC_TORCH_TAR"; then
+    tar -xf "$MLCC_TORCH_TAR";
+else
+    cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/pytorch/pytorch.git" v0.4.0 pytorch --recursive &&
+    cd /tmp/pytorch &&
+    if [ ! -d /usr/local/cuda ]; then export NO_CUDA=1; fi &&
+    env MAX_JOBS=`getconf _NPROCESSORS_ONLN` MKLDNN_HOME=/usr/local
+        BLAS="$MLCC_TORCH_BLAS" WITH_BLAS="$MLCC_TORCH_BLAS"
+        CFLAGS="${MLCC_CPU_ARCH:+-march=$MLCC_CPU_ARCH}" CXXFLAGS="${MLCC_CPU_ARCH:+-march=$MLCC_CPU_ARCH}"
+        python setup.py bdist_wheel &&
+    cp dist/torch-*.whl /opt/mlcc/wheels/ &&
+    cd /opt/mlcc/wheels && tar -cf "$MLCC_TORCH_TAR" torch-*.whl;
+    cd /tmp && /bin/rm -rf /tmp/pytorch;
+fi;
+pip install /opt/mlcc/wheels/torch-*.whl torchvision;
+mkdir -p /etc/mlcc && echo "torch v0.4.0 $MLCC_TORCH_BUILD" > /etc/mlcc/pytorch-build
+\nRUN python -c 'import torch'
+) },
+
+// HOROVOD_* are ARGs written ahead of this (see write_horovod_args())
+{ 600, 0, "Horovod", "Horovod", BS( RUN
+pip install --no-cache-dir horovod==0.16.0;
+horovodrun --help > /dev/null
+\nRUN python -c 'import horovod'
+) },
+
 // FIXME: specific version
 { 600, 0, "Julia", "Julia", BS( RUN
 cd /tmp &&
-wget -q "https://julialang-s3.julialang.org/bin/linux/x64/0.6/julia-0.6.2-linux-x86_64.tar.gz" &&
+/tmp/mlcc_fetch.sh "https://julialang-s3.julialang.org/bin/linux/x64/0.6/julia-0.6.2-linux-x86_64.tar.gz" &&
 tar -xf julia*.gz &&
 /bin/rm julia*.gz;
 cd /tmp/julia* && /bin/rm LICENSE.md && /bin/cp -a . /usr/local;
@@ -938,8 +1278,8 @@ cd /tmp && /bin/rm -rf /tmp/julia*
 
 // FIXME: specific version
 { 600, 0, "R-studio", "R-studio", BS( RUN 
-cd /tmp && wget -q "https://download1.rstudio.org/rstudio-1.1.447-x86_64.rpm";
-cd /tmp && yum -y install --nogpgcheck rstudio*.rpm; cd /var/cache && /bin/rm -rf dnf yum
+cd /tmp && /tmp/mlcc_fetch.sh "https://download1.rstudio.org/rstudio-1.1.447-x86_64.rpm";
+cd /tmp && yum -y install --nogpgcheck rstudio*.rpm; /bin/rm -f /tmp/rstudio*.rpm; cd /var/cache && /bin/rm -rf dnf yum
 ) },
 
 // { 600, 0, "gpuRcuda", "gpuRcuda", BS( # Sorry! gpuRcuda is NYI. See: "https://github.com/gpuRcore/gpuRcuda" ) },
@@ -951,7 +1291,7 @@ cd /tmp && yum -y install --nogpgcheck rstudio*.rpm; cd /var/cache && /bin/rm -r
 // rpud: see: // "http://www.r-tutor.com/content/download"
 // "https://github.com/cran/rpud/blob/master/INSTALL"
 { 600, 0, "rpud", "rpud", BS( RUN
-cd /tmp && wget -q "http://www.r-tutor.com/sites/default/files/rpud/rpux_0.6.1_linux.tar.gz" && tar -xf rpux*.gz;
+cd /tmp && /tmp/mlcc_fetch.sh "http://www.r-tutor.com/sites/default/files/rpud/rpux_0.6.1_linux.tar.gz" && tar -xf rpux*.gz;
 echo "install.packages(\"/tmp/rpux_0.6.1_linux/rpud_0.6.1.tar.gz\")" > /tmp/rpud_install.R;
 /usr/bin/Rscript /tmp/rpud_install.R;
 cd /tmp && /bin/rm -rf /tmp/rpu*
@@ -975,7 +1315,7 @@ pip install scikit-learn
 
 
 { 600, 0, "Theano", "Theano", BS( RUN 
-cd /tmp && git clone --depth 1 "https://github.com/Theano/libgpuarray.git";
+cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/Theano/libgpuarray.git" v0.7.6 libgpuarray;
 mkdir -p /tmp/libgpuarray/build &&
 cd /tmp/libgpuarray/build &&
 cmake .. -DCMAKE_BUILD_TYPE=Release &&
@@ -1058,9 +1398,9 @@ pip install keras
 yum -y install swig; cd /var/cache && /bin/rm -rf dnf yum;
 pip install wheel;
 pip install 'protobuf>=3.0.0';
-cd /tmp && git clone "https://github.com/PaddlePaddle/Paddle" paddle;
+cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/PaddlePaddle/Paddle.git" v0.12.0 paddle;
 mkdir -p /tmp/paddle/build && cd /tmp/paddle/build &&
-cmake .. -DCMAKE_INSTALL_PREFIX=/usr/local &&
+cmake .. -DCMAKE_INSTALL_PREFIX=/usr/local ${MLCC_CUDA_ARCH_BIN:+-DCUDA_ARCH_NAME=Manual -DCUDA_ARCH_BIN="$MLCC_CUDA_ARCH_BIN" -DCUDA_ARCH_PTX="$MLCC_CUDA_ARCH_PTX"} &&
 make -j`getconf _NPROCESSORS_ONLN` && make install &&
 ldconfig;
 ls -l /usr/local/opt;
@@ -1076,9 +1416,9 @@ cd /tmp && /bin/rm -rf /tmp/paddle
 // make pycaffe
 { 600, 0, "Caffe", "Caffe", BS( RUN
 /tmp/yum_install.sh boost-devel gflags-devel glog-devel hdf5-devel leveldb-devel libjpeg-turbo-devel
-libtiff lmdb-devel openblas-devel opencv-devel protobuf-devel snappy-devel;
+libtiff lmdb-devel openblas-devel protobuf-devel snappy-devel `[ -e /usr/local/include/opencv2/core.hpp ] || echo opencv-devel`;
 ldconfig;
-cd /usr/local && git clone -b 1.0 --depth 1 "https://github.com/BVLC/caffe.git";
+cd /usr/local && /tmp/mlcc_git_clone.sh "https://github.com/BVLC/caffe.git" 1.0 caffe;
 cd /usr/local/caffe && cp Makefile.config.example Makefile.config &&
 echo -e '36,38c36\n< \
 CUDA_ARCH := -gencode arch=compute_20,code=sm_20 \\\n< \t\t-gencode arch=compute_20,code=sm_21 \\\n< \t\t-gencode arch=compute_30,code=sm_30 \\\n---\n> \
@@ -1088,6 +1428,7 @@ BLAS := atlas\n---\n> # BLAS := atlas\n68,69c66,67\n< \
 PYTHON_INCLUDE := /usr/include/python2.7 \\\n< \t\t/usr/lib/python2.7/dist-packages/numpy/core/include\n---\n> # \
 PYTHON_INCLUDE := /usr/include/python2.7 \\\n> # \t\t/usr/lib/python2.7/dist-packages/numpy/core/include'
 >> diff.out && patch --ignore-whitespace Makefile.config diff.out;
+if [ -e /usr/local/include/opencv2/imgcodecs.hpp ]; then echo "OPENCV_VERSION := 3" >> Makefile.config; fi;
 pip install -r /usr/local/caffe/python/requirements.txt;
 echo -e '\
 set -vx \n\
@@ -1104,23 +1445,25 @@ export
 USE_CUDNN=1
 BLAS=open
 BLAS_INCLUDE=/usr/include/openblas;
-cd /usr/local/caffe && make all -j`getconf _NPROCESSORS_ONLN` && make test -j`getconf _NPROCESSORS_ONLN`
+cd /usr/local/caffe &&
+make all -j`getconf _NPROCESSORS_ONLN` ${MLCC_CUDA_GENCODE:+CUDA_ARCH="$MLCC_CUDA_GENCODE"} &&
+make test -j`getconf _NPROCESSORS_ONLN` ${MLCC_CUDA_GENCODE:+CUDA_ARCH="$MLCC_CUDA_GENCODE"}
 ) },
 
 // See: "https://caffe2.ai/docs/getting-started.html"
 // pip install future graphviz hypothesis jupyter matplotlib numpy protobuf pydot python-nvd3 pyyaml requests scikit-image scipy six;
 { 600, 0, "Caffe2", "Caffe2", BS( RUN
 /tmp/yum_install.sh automake kernel-devel leveldb-devel libtool lmdb-devel protobuf-devel snappy-devel;
-cd /tmp && git clone "https://github.com/gflags/gflags.git" && cd gflags && mkdir build && cd build &&
+cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/gflags/gflags.git" v2.2.1 gflags && cd gflags && mkdir build && cd build &&
 cmake -DBUILD_SHARED_LIBS=ON -DCMAKE_CXX_FLAGS='-fPIC' .. &&
 make -j`getconf _NPROCESSORS_ONLN` && make install;
-cd /tmp && git clone "https://github.com/google/glog" && cd glog && mkdir build && cd build &&
+cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/google/glog.git" v0.3.5 glog && cd glog && mkdir build && cd build &&
 cmake -DBUILD_SHARED_LIBS=ON -DCMAKE_CXX_FLAGS='-fPIC' .. &&
 make -j`getconf _NPROCESSORS_ONLN` && make install;
 pip install future graphviz hypothesis protobuf pydot python-nvd3 pyyaml requests six;
 cd /tmp && mkdir caffe2 &&
-cd caffe2 && git clone --recursive "https://github.com/pytorch/pytorch.git" &&
-cd pytorch && git submodule update --init;
+cd caffe2 && /tmp/mlcc_git_clone.sh "https://github.com/pytorch/pytorch.git" v0.4.0 pytorch --recursive &&
+cd pytorch;
 if [ -x /usr/local/bin/python ]; then
     mkdir build && cd build && cmake -DCMAKE_INSTALL_PREFIX=/usr/local .. && make -j`getconf _NPROCESSORS_ONLN` install;
 else
@@ -1163,535 +1506,4793 @@ chmod -v +x /root/.vnc/xstartup;
 echo 123456 | vncpasswd -f > /root/.vnc/passwd;
 chmod -v 600 /root/.vnc/passwd
 \nEXPOSE 5901
+) },
+
+
+//
+//
+// Parallel Compute Packages (PARALLEL_LO_PO_NUM_START == 650 <= po_num < 700 == INPUT_LO_PO_NUM_START)
+//
+// These come after the Numpy/Pandas/Scikit stack they scale out.
+// "mlcc_dask_bench [tasks]" and "mlcc_ray_bench [tasks]" in the image run a
+// CPU bound task set on local clusters of 1, 2, 4... workers up to the number
+// of CPUs, and report the speedup over one worker.
+//
+//
+
+// Dask scheduler 8786, dashboard 8787.  With joblib, scikit-learn fits can
+// run on the cluster through joblib.parallel_backend("dask").
+{ 650, 0, "Dask", "Dask distributed", BS( RUN
+pip install "dask[complete]" distributed joblib;
+echo -e '\
+import multiprocessing \n\
+import sys \n\
+import time \n\
+from dask.distributed import Client, LocalCluster \n\
+def work(n): \n\
+    s = 0 \n\
+    for i in range(n): \n\
+        s += i * i % 7 \n\
+    return s \n\
+if __name__ == "__main__": \n\
+    tasks = int(sys.argv[1]) if len(sys.argv) > 1 else 64 \n\
+    ncpu = multiprocessing.cpu_count() \n\
+    workers = [1] \n\
+    while workers[-1] * 2 <= ncpu: \n\
+        workers.append(workers[-1] * 2) \n\
+    if workers[-1] != ncpu: \n\
+        workers.append(ncpu) \n\
+    print("%d tasks, %d cpus" % (tasks, ncpu)) \n\
+    print("%8s %10s %8s" % ("workers", "seconds", "speedup")) \n\
+    base = 0 \n\
+    for w in workers: \n\
+        with LocalCluster(n_workers=w, threads_per_worker=1) as cluster: \n\
+            with Client(cluster) as client: \n\
+                client.gather(client.map(work, [1000] * w, pure=False)) \n\
+                t = time.time() \n\
+                client.gather(client.map(work, [1000000] * tasks, pure=False)) \n\
+                t = time.time() - t \n\
+        base = base or t \n\
+        print("%8d %10.2f %8.2f" % (w, t, base / t)) \n'
+>> /usr/local/bin/mlcc_dask_bench;
+sed -i "1i #!`command -v python`" /usr/local/bin/mlcc_dask_bench;
+chmod +x /usr/local/bin/mlcc_dask_bench
+\nEXPOSE 8786 8787
+\nRUN python -c 'import dask.distributed'
+) },
+
+// Ray head (redis) 6379, dashboard 8265
+{ 650, 0, "Ray", "Ray", BS( RUN
+pip install ray;
+echo -e '\
+import multiprocessing \n\
+import sys \n\
+import time \n\
+import ray \n\
+def work(n): \n\
+    s = 0 \n\
+    for i in range(n): \n\
+        s += i * i % 7 \n\
+    return s \n\
+if __name__ == "__main__": \n\
+    tasks = int(sys.argv[1]) if len(sys.argv) > 1 else 64 \n\
+    ncpu = multiprocessing.cpu_count() \n\
+    workers = [1] \n\
+    while workers[-1] * 2 <= ncpu: \n\
+        workers.append(workers[-1] * 2) \n\
+    if workers[-1] != ncpu: \n\
+        workers.append(ncpu) \n\
+    print("%d tasks, %d cpus" % (tasks, ncpu)) \n\
+    print("%8s %10s %8s" % ("workers", "seconds", "speedup")) \n\
+    base = 0 \n\
+    for w in workers: \n\
+        ray.init(num_cpus=w) \n\
+        remote_work = ray.remote(work) \n\
+        ray.get([remote_work.remote(1000) for i in range(w)]) \n\
+        t = time.time() \n\
+        ray.get([remote_work.remote(1000000) for i in range(tasks)]) \n\
+        t = time.time() - t \n\
+        ray.shutdown() \n\
+        base = base or t \n\
+        print("%8d %10.2f %8.2f" % (w, t, base / t)) \n'
+>> /usr/local/bin/mlcc_ray_bench;
+sed -i "1i #!`command -v python`" /usr/local/bin/mlcc_ray_bench;
+chmod +x /usr/local/bin/mlcc_ray_bench
+\nEXPOSE 6379 8265
+\nRUN python -c 'import ray'
+) },
+
+
+//
+//
+// Input Pipeline Packages (INPUT_LO_PO_NUM_START == 700 <= po_num)
+//
+// These come last, so Pillow-SIMD replaces any stock Pillow the packages
+// above pulled in.  "mlcc_input_bench [n]" in the image reports decode and
+// resize images/s from memory, LMDB and TFRecord.
+//
+//
+
+// Only selected along with a CUDA accelerator, see check_dali_accelerator()
+{ 700, 0, "DALI", "NVIDIA DALI (CUDA only)", BS( RUN
+pip install --extra-index-url "https://developer.download.nvidia.com/compute/redist" nvidia-dali &&
+python -c 'import nvidia.dali'
+) },
+
+{ 700, 0, "LMDB", "LMDB tools and Python bindings", BS( RUN
+/tmp/yum_install.sh lmdb lmdb-devel; pip install lmdb
+\nRUN python -c 'import lmdb'
+) },
+
+// mlcc_tfrecord_index writes the "offset size" index DALI readers want
+{ 700, 0, "TFRecord", "TFRecord tools", BS( RUN
+echo -e '\
+import os \n\
+import struct \n\
+import sys \n\
+src = sys.argv[1] \n\
+dst = sys.argv[2] if len(sys.argv) > 2 else src + ".idx" \n\
+n = 0 \n\
+with open(src, "rb") as f: \n\
+    with open(dst, "w") as idx: \n\
+        while True: \n\
+            offset = f.tell() \n\
+            head = f.read(12) \n\
+            if len(head) < 12: \n\
+                break \n\
+            size = struct.unpack("<Q", head[:8])[0] \n\
+            f.seek(size + 4, 1) \n\
+            idx.write("%d %d%s" % (offset, size + 16, os.linesep)) \n\
+            n += 1 \n\
+print("%s: %d records, index in %s" % (src, n, dst)) \n'
+>> /usr/local/bin/mlcc_tfrecord_index;
+sed -i "1i #!`command -v python`" /usr/local/bin/mlcc_tfrecord_index;
+chmod +x /usr/local/bin/mlcc_tfrecord_index
+) },
+
+{ 700, 0, "Pillow-SIMD", "Pillow-SIMD on libjpeg-turbo", BS( RUN
+/tmp/yum_install.sh freetype-devel lcms2-devel libjpeg-turbo-devel libtiff-devel libwebp-devel zlib-devel;
+pip uninstall -y pillow pillow-simd;
+if [ -n "$MLCC_CPU_ARCH" ]; then MLCC_MARCH="-march=$MLCC_CPU_ARCH"; else MLCC_MARCH="-mavx2"; fi;
+CC="gcc $MLCC_MARCH" pip install --no-cache-dir --force-reinstall --no-binary :all: pillow-simd;
+echo -e '\
+import io \n\
+import shutil \n\
+import struct \n\
+import sys \n\
+import tempfile \n\
+import time \n\
+from PIL import Image \n\
+n = int(sys.argv[1]) if len(sys.argv) > 1 else 500 \n\
+print("PIL %s" % getattr(Image, "PILLOW_VERSION", "")) \n\
+buf = io.BytesIO() \n\
+Image.effect_mandelbrot((1024, 768), (-2.0, -1.2, 1.0, 1.2), 100).convert("RGB").save(buf, "JPEG", quality=90) \n\
+jpg = buf.getvalue() \n\
+def bench(name, records): \n\
+    t = time.time() \n\
+    for data in records: \n\
+        Image.open(io.BytesIO(data)).convert("RGB").resize((224, 224), Image.BILINEAR) \n\
+    print("%-10s %8.1f images/s" % (name, n / (time.time() - t))) \n\
+bench("memory", (jpg for i in range(n))) \n\
+tmp = tempfile.mkdtemp() \n\
+try: \n\
+    import lmdb \n\
+    env = lmdb.open(tmp + "/lmdb", map_size=1 << 32) \n\
+    with env.begin(write=True) as txn: \n\
+        for i in range(n): \n\
+            txn.put(("%08d" % i).encode(), jpg) \n\
+    with env.begin() as txn: \n\
+        bench("lmdb", (v for k, v in txn.cursor())) \n\
+except ImportError: \n\
+    pass \n\
+with open(tmp + "/images.tfrecord", "wb") as f: \n\
+    for i in range(n): \n\
+        f.write(struct.pack("<QI", len(jpg), 0) + jpg + struct.pack("<I", 0)) \n\
+def tfrecords(path): \n\
+    with open(path, "rb") as f: \n\
+        for i in range(n): \n\
+            size = struct.unpack("<QI", f.read(12))[0] \n\
+            yield f.read(size) \n\
+            f.read(4) \n\
+bench("tfrecord", tfrecords(tmp + "/images.tfrecord")) \n\
+shutil.rmtree(tmp) \n'
+>> /usr/local/bin/mlcc_input_bench;
+sed -i "1i #!`command -v python`" /usr/local/bin/mlcc_input_bench;
+chmod +x /usr/local/bin/mlcc_input_bench
+\nRUN python -c 'from PIL import Image'
+) },
+
+
+//
+//
+// Inference Packages (INFERENCE_LO_PO_NUM_START == 800 <= po_num < 900 == PROFILING_LO_PO_NUM_START)
+//
+// These install under /opt/mlcc/serving, with a bundled sample model, a
+// warmup hook in warmup.d and a CPU latency/throughput bench.  With
+// --inference, only /opt/mlcc/serving (and the Python runtime) is copied into
+// a final runtime stage, see write_inference_stage().  MLCC_SERVING_MKL is an
+// ARG written ahead of them when MKL or MKL-DNN is selected.
+//
+//
+
+{ 800, 0, "TF-Serving", "TensorFlow Serving 1.8.0", BS( RUN
+cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/tensorflow/serving.git" 1.8.0 serving;
+cd /tmp/serving &&
+bazel build -c opt
+    ${MLCC_CPU_ARCH:+--copt=-march=$MLCC_CPU_ARCH}
+    `[ "$MLCC_SERVING_MKL" == "1" ] && echo --config=mkl`
+    --jobs=`getconf _NPROCESSORS_ONLN`
+    --verbose_failures=1
+    "//tensorflow_serving/model_servers:tensorflow_model_server" &&
+mkdir -p /opt/mlcc/serving/bin /opt/mlcc/serving/models /opt/mlcc/serving/warmup.d &&
+cp bazel-bin/tensorflow_serving/model_servers/tensorflow_model_server /opt/mlcc/serving/bin/ &&
+cp -r tensorflow_serving/servables/tensorflow/testdata/saved_model_half_plus_two_cpu /opt/mlcc/serving/models/half_plus_two;
+cd /tmp && /bin/rm -rf /tmp/serving /root/.cache/bazel*;
+echo -e '\
+import json \n\
+import sys \n\
+import time \n\
+try: \n\
+    from urllib.request import Request, urlopen \n\
+except ImportError: \n\
+    from urllib2 import Request, urlopen \n\
+n = int(sys.argv[1]) if len(sys.argv) > 1 else 1000 \n\
+url = "http://localhost:8501/v1/models/half_plus_two:predict" \n\
+body = json.dumps({"instances": [1.0, 2.0, 5.0]}).encode() \n\
+for i in range(300): \n\
+    try: \n\
+        urlopen(Request(url, body)).read() \n\
+        break \n\
+    except Exception: \n\
+        time.sleep(0.1) \n\
+lat = [] \n\
+t = time.time() \n\
+for i in range(n): \n\
+    s = time.time() \n\
+    urlopen(Request(url, body)).read() \n\
+    lat.append(time.time() - s) \n\
+t = time.time() - t \n\
+lat.sort() \n\
+print("tf-serving: %d requests, %.1f req/s, p50 %.2f ms, p99 %.2f ms" % (n, n / t, lat[n // 2] * 1e3, lat[int(n * 0.99)] * 1e3)) \n'
+>> /opt/mlcc/serving/bin/mlcc_tf_serving_bench;
+echo -e '\
+#!/bin/bash \n\
+exec python /opt/mlcc/serving/bin/mlcc_tf_serving_bench 20 > /dev/null \n'
+>> /opt/mlcc/serving/warmup.d/tf-serving;
+sed -i "1i #!/usr/bin/env python" /opt/mlcc/serving/bin/mlcc_tf_serving_bench;
+chmod +x /opt/mlcc/serving/bin/mlcc_tf_serving_bench /opt/mlcc/serving/warmup.d/tf-serving
+\nENV PATH=/opt/mlcc/serving/bin:$PATH
+\nEXPOSE 8500 8501
+) },
+
+// The wheel is kept in /opt/mlcc/serving/wheels for the runtime stage, and the
+// sample model is a 256-1024-1000 float MLP.
+{ 800, 0, "ONNX-Runtime", "ONNX Runtime 0.2.1", BS( RUN
+pip install --target /tmp/mlcc-cmake cmake;
+cd /tmp && /tmp/mlcc_git_clone.sh "https://github.com/Microsoft/onnxruntime.git" v0.2.1 onnxruntime --recursive &&
+cd /tmp/onnxruntime &&
+env PATH=/tmp/mlcc-cmake/bin:$PATH PYTHONPATH=/tmp/mlcc-cmake
+    CFLAGS="${MLCC_CPU_ARCH:+-march=$MLCC_CPU_ARCH}" CXXFLAGS="${MLCC_CPU_ARCH:+-march=$MLCC_CPU_ARCH}"
+    ./build.sh --config Release --build_wheel --parallel --use_openmp `[ "$MLCC_SERVING_MKL" == "1" ] && echo --use_mklml` &&
+mkdir -p /opt/mlcc/serving/bin /opt/mlcc/serving/models /opt/mlcc/serving/warmup.d /opt/mlcc/serving/wheels &&
+cp build/Linux/Release/dist/onnxruntime-*.whl /opt/mlcc/serving/wheels/ &&
+pip install /opt/mlcc/serving/wheels/onnxruntime-*.whl;
+cd /tmp && /bin/rm -rf /tmp/onnxruntime /tmp/mlcc-cmake;
+pip install --target /tmp/mlcc-onnx onnx==1.4.1;
+echo -e '\
+import sys \n\
+import numpy as np \n\
+from onnx import TensorProto, helper, numpy_helper, save \n\
+np.random.seed(0) \n\
+w1 = numpy_helper.from_array(np.random.rand(256, 1024).astype(np.float32), "w1") \n\
+w2 = numpy_helper.from_array(np.random.rand(1024, 1000).astype(np.float32), "w2") \n\
+nodes = [helper.make_node("MatMul", ["x", "w1"], ["h"]), helper.make_node("Relu", ["h"], ["r"]), helper.make_node("MatMul", ["r", "w2"], ["y"])] \n\
+x = helper.make_tensor_value_info("x", TensorProto.FLOAT, [1, 256]) \n\
+y = helper.make_tensor_value_info("y", TensorProto.FLOAT, [1, 1000]) \n\
+graph = helper.make_graph(nodes, "mlcc_mlp", [x], [y], [w1, w2]) \n\
+save(helper.make_model(graph, opset_imports=[helper.make_opsetid("", 8)]), sys.argv[1]) \n'
+>> /tmp/mlcc_onnx_model.py;
+PYTHONPATH=/tmp/mlcc-onnx python /tmp/mlcc_onnx_model.py /opt/mlcc/serving/models/mlp.onnx;
+/bin/rm -rf /tmp/mlcc-onnx /tmp/mlcc_onnx_model.py;
+echo -e '\
+import sys \n\
+import time \n\
+import numpy as np \n\
+import onnxruntime \n\
+n = int(sys.argv[1]) if len(sys.argv) > 1 else 1000 \n\
+model = sys.argv[2] if len(sys.argv) > 2 else "/opt/mlcc/serving/models/mlp.onnx" \n\
+sess = onnxruntime.InferenceSession(model) \n\
+inp = sess.get_inputs()[0] \n\
+feed = {inp.name: np.random.rand(*[d if isinstance(d, int) else 1 for d in inp.shape]).astype(np.float32)} \n\
+sess.run(None, feed) \n\
+lat = [] \n\
+t = time.time() \n\
+for i in range(n): \n\
+    s = time.time() \n\
+    sess.run(None, feed) \n\
+    lat.append(time.time() - s) \n\
+t = time.time() - t \n\
+lat.sort() \n\
+print("onnxruntime %s: %d runs, %.1f runs/s, p50 %.3f ms, p99 %.3f ms" % (model, n, n / t, lat[n // 2] * 1e3, lat[int(n * 0.99)] * 1e3)) \n'
+>> /opt/mlcc/serving/bin/mlcc_onnx_bench;
+echo -e '\
+#!/bin/bash \n\
+exec python /opt/mlcc/serving/bin/mlcc_onnx_bench 20 > /dev/null \n'
+>> /opt/mlcc/serving/warmup.d/onnx-runtime;
+sed -i "1i #!/usr/bin/env python" /opt/mlcc/serving/bin/mlcc_onnx_bench;
+chmod +x /opt/mlcc/serving/bin/mlcc_onnx_bench /opt/mlcc/serving/warmup.d/onnx-runtime
+\nENV PATH=/opt/mlcc/serving/bin:$PATH
+\nRUN python -c 'import onnxruntime'
+) },
+
+
+//
+//
+// Profiling Packages (PROFILING_LO_PO_NUM_START == 900 <= po_num)
+//
+// These come last and only add small layers on top, so adding them to an
+// image reuses all of its build cache.  Most need the container run with
+// --cap-add SYS_PTRACE (py-spy, valgrind attach) or --privileged and a
+// permissive kernel.perf_event_paranoid (perf).
+//
+//
+
+{ 900, 0, "Perf-Tools", "perf, numactl and hwloc", BS( RUN
+/tmp/yum_install.sh perf numactl hwloc;
+perf --version; numactl --hardware || true; lstopo-no-graphics || true
+) },
+
+// Run with LD_PRELOAD=/usr/lib64/libprofiler.so CPUPROFILE=<file>, then pprof
+{ 900, 0, "Gperftools", "gperftools CPU and heap profilers", BS( RUN
+/tmp/yum_install.sh gperftools gperftools-devel;
+pprof --version | head -1
+) },
+
+// massif is "valgrind --tool=massif", ms_print reads its output
+{ 900, 0, "Valgrind", "Valgrind and massif", BS( RUN
+/tmp/yum_install.sh valgrind;
+valgrind --version
+) },
+
+// "mlcc_flamegraph <pid> [seconds] [svg]" samples a running Python process,
+// including native frames where py-spy can, into a flame graph SVG.
+{ 900, 0, "Py-Spy", "py-spy sampling profiler", BS( RUN
+pip install py-spy==0.3.14;
+echo -e '\
+#!/bin/bash \n\
+PID="${1:?usage: mlcc_flamegraph <pid> [seconds] [svg]}" \n\
+SECONDS_TO_RECORD="${2:-30}" \n\
+SVG="${3:-/tmp/mlcc-flamegraph-$PID.svg}" \n\
+py-spy record --pid "$PID" --duration "$SECONDS_TO_RECORD" --output "$SVG" --native || \n\
+py-spy record --pid "$PID" --duration "$SECONDS_TO_RECORD" --output "$SVG" || { \n\
+    echo "py-spy could not attach to $PID, is the container run with --cap-add SYS_PTRACE?"; \n\
+    exit 1; \n\
+} \n\
+echo "flame graph in $SVG" \n'
+>> /usr/local/bin/mlcc_flamegraph;
+chmod +x /usr/local/bin/mlcc_flamegraph;
+py-spy --version
+) },
+
+//
+// "mlcc_framework_profile [out]" runs a few steps of a small model under the
+// native profiler of each framework in the image, the tf.RunMetadata step
+// trace of TensorFlow 1.x and torch.autograd.profiler (what torch.profiler
+// builds on), and writes a Chrome trace (chrome://tracing) of each to
+// <out>-tensorflow.json and <out>-torch.json.
+//
+{ 900, 0, "Framework-Profilers", "TensorFlow and PyTorch profiler traces", BS( RUN
+echo -e '\
+import sys \n\
+out = sys.argv[1] if len(sys.argv) > 1 else "/tmp/mlcc-profile" \n\
+try: \n\
+    import tensorflow as tf \n\
+    from tensorflow.python.client import timeline \n\
+    tf1 = getattr(getattr(tf, "compat", None), "v1", None) or tf \n\
+    if hasattr(tf1, "disable_eager_execution"): \n\
+        tf1.disable_eager_execution() \n\
+    a = tf1.random_normal([512, 512]) \n\
+    b = tf1.nn.relu(tf1.matmul(a, a)) \n\
+    with tf1.Session() as sess: \n\
+        meta = tf1.RunMetadata() \n\
+        for i in range(5): \n\
+            sess.run(b, options=tf1.RunOptions(trace_level=tf1.RunOptions.FULL_TRACE), run_metadata=meta) \n\
+    with open(out + "-tensorflow.json", "w") as f: \n\
+        f.write(timeline.Timeline(meta.step_stats).generate_chrome_trace_format()) \n\
+    print("TensorFlow trace in %s-tensorflow.json" % out) \n\
+except ImportError: \n\
+    pass \n\
+try: \n\
+    import torch \n\
+    a = torch.randn(512, 512) \n\
+    with torch.autograd.profiler.profile() as prof: \n\
+        for i in range(5): \n\
+            torch.relu(torch.mm(a, a)) \n\
+    prof.export_chrome_trace(out + "-torch.json") \n\
+    print("PyTorch trace in %s-torch.json" % out) \n\
+except ImportError: \n\
+    pass \n'
+>> /usr/local/bin/mlcc_framework_profile;
+sed -i "1i #!`command -v python`" /usr/local/bin/mlcc_framework_profile;
+chmod +x /usr/local/bin/mlcc_framework_profile
 ) }
 
 };
-#define NUM_PKGS (sizeof(pkgs) / sizeof(pkgs[0]))
+#define NUM_BUILTIN_PKGS (sizeof(builtin_pkgs) / sizeof(builtin_pkgs[0]))
 
+// The built in pkgs, and then those of the catalogs, in po_num order
+#define MAX_CATALOG_PKGS 256
+#define MAX_PKGS (NUM_BUILTIN_PKGS + MAX_CATALOG_PKGS)
+struct pkg_data pkgs[MAX_PKGS];
+int num_pkgs = 0;
+#define NUM_PKGS num_pkgs
 
-struct pkg_data *selected_set[NUM_PKGS];
-struct pkg_data *available_set[NUM_PKGS];
-int num_selected = 0;
-int num_available = 0;
 
+//
+// Catalogs add pkgs to, or replace pkgs of, the built in ones above, so a
+// site can have its own pkgs without patching mlcc.  They are written in
+// data files like:
+//
+//     # Comment
+//     pkg Our-Lib
+//     po 610
+//     desc Our in house library
+//     requires Numpy,Scipy
+//     conflicts OpenCV-src
+//     frag
+//     RUN pip install our-lib
+//     RUN python -c 'import our_lib'
+//     end
+//
+// "mlcc catalog <out> <file>..." (see "make catalog") compiles them into a
+// binary catalog: a header, the pkgs, a hash index of their labels, their
+// requires (marked 2) and conflicts (marked 0) and a string table, linked
+// by offsets.  Each catalog of $MLCC_CATALOG (: separated) and of each
+// --catalog is mapped read-only, its offsets checked and its pkgs pointed
+// at its strings, with nothing parsed, and the pages are shared by every
+// mlcc mapping it.  A catalog pkg with the label and po_num of one already
+// there replaces its desc and frag, so a site catalog overlays a base one.
+// One with a label already there at another po_num is an error, as -i would
+// then select both.  Others go in by po_num.
+//
 
-void list_all_packages() {
-    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
-        printf("(%d) %s: %s\n", ix, pkgs[ix].label, pkgs[ix].desc);
-    }
-}
+#define CATALOG_MAGIC "MLCCCAT1"
+
+struct catalog_header {
+    char magic[8];
+    uint32_t num_pkgs;
+    uint32_t num_buckets;
+    uint32_t num_deps;
+    uint32_t pkgs_offset;
+    uint32_t buckets_offset;
+    uint32_t deps_offset;
+    uint32_t strings_offset;
+    uint32_t strings_len;
+};
 
+struct catalog_pkg {
+    int32_t po_num;
+    uint32_t label;  // string table offsets
+    uint32_t desc;
+    uint32_t frag;
+    uint32_t first_dep;
+    uint32_t num_deps;
+    uint32_t next;  // 1 + index of the next pkg in its hash bucket, 0 at the end
+};
 
-void display_set(char *title, struct pkg_data **set, int *num, int lo_po_num_start, int hi_po_num_limit) {
-    struct winsize win_info;
-    ioctl(0, TIOCGWINSZ, &win_info);
-    // printf ("lines %d\n", win_info.ws_row);
-    // printf ("columns %d\n", win_info.ws_col);
-    printf("\n%s:\n", title);
-    int line_length = 0;
-    for (int ix = 0;  (ix < *num);  ix++) {
-        if ((set[ix]->po_num >= lo_po_num_start) && (set[ix]->po_num < hi_po_num_limit)) {
-            printf("%2d: %-20s", ix, set[ix]->label);
-            line_length += 24;
-            if (line_length +24  > win_info.ws_col) {
-                line_length = 0;
-                printf("\n");
-            }
-        }
-    }
-    printf("\n");
+struct catalog_dep {
+    uint32_t label;
+    int32_t mark;
+};
+
+#define MAX_CATALOGS 8
+#define MAX_CATALOG_DEPS 1024
+struct catalog_data {
+    char *path;
+    size_t len;
+    const struct catalog_header *header;
+    const struct catalog_pkg *pkgs;
+    const uint32_t *buckets;
+    const struct catalog_dep *deps;
+    const char *strings;
+} catalogs[MAX_CATALOGS];
+int num_catalogs = 0;
+
+
+void init_pkgs() {
+    memcpy(pkgs, builtin_pkgs, sizeof(builtin_pkgs));
+    num_pkgs = NUM_BUILTIN_PKGS;
 }
 
 
-void sort_set_by_label_and_remove_duplicates(struct pkg_data **set, int *num) {
-    int n = *num;
-    for (int ix = 0;  (ix < n);  ix++) {
-        for (int iy = ix + 1;  (iy < n);  iy++) {
-            int different = strcasecmp(set[iy]->label, set[ix]->label);
-            if (!different) {
-                set[iy] = set[(n - 1)];
-                n -= 1;
-                iy -= 1;
-                continue;
-            } else if (different < 0) {
-                struct pkg_data *p = set[ix];
-                set[ix] = set[iy];
-                set[iy] = p;
-            }
-        }
+uint32_t hash_label(const char *s) {
+    // FNV-1a, lower cased as labels match with strcasecmp()
+    uint32_t hash = 2166136261u;
+    for (;  *s;  s++) {
+        hash = (hash ^ tolower((unsigned char)*s)) * 16777619u;
     }
-    *num = n;
+    return hash;
 }
 
 
-void sort_set_by_po_num(struct pkg_data **set, int *num) {
-    int n = *num;
-    for (int ix = 0;  (ix < n);  ix++) {
-        for (int iy = ix + 1;  (iy < n);  iy++) {
-            if (set[iy]->po_num < set[ix]->po_num) {
-                struct pkg_data *p = set[ix];
-                set[ix] = set[iy];
-                set[iy] = p;
-            }
+void add_catalog_pkg(struct pkg_data *p) {
+    int other_po_num = -1;
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if ((pkgs[ix].po_num == p->po_num) && !strcasecmp(pkgs[ix].label, p->label)) {
+            pkgs[ix].desc = p->desc;
+            pkgs[ix].frag = p->frag;
+            return;
+        }
+        if (!strcasecmp(pkgs[ix].label, p->label)) {
+            other_po_num = pkgs[ix].po_num;
         }
     }
-    *num = n;
+    if (other_po_num >= 0) {
+        fprintf(stderr, "Catalog pkg %s has po %d, but %s is already at po %d\n", p->label, p->po_num, p->label, other_po_num);
+        exit(EXIT_FAILURE);
+    }
+    if (num_pkgs >= MAX_PKGS) {
+        fprintf(stderr, "More than %d catalog pkgs\n", MAX_CATALOG_PKGS);
+        exit(EXIT_FAILURE);
+    }
+    int at = num_pkgs++;
+    for (;  (at > 0) && (pkgs[at - 1].po_num > p->po_num);  at--) {
+        pkgs[at] = pkgs[at - 1];
+    }
+    pkgs[at] = *p;
 }
 
 
-void add_to_set(struct pkg_data *p, struct pkg_data **set, int *n) {
-    set[*n] = p;
-    *n += 1;
+int catalog_range_ok(size_t len, uint32_t offset, uint64_t size) {
+    return ((offset % 4) == 0) && ((offset + size) <= len);
 }
 
 
-void partition_selected() {
-    num_selected = 0;
-    num_available = 0;
-    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
-        if (pkgs[ix].include) {
-            add_to_set(&(pkgs[ix]), selected_set, &num_selected);
-        } else {
-            add_to_set(&(pkgs[ix]), available_set, &num_available);
+void load_catalog(char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if ((fd < 0) || (fstat(fd, &sb) < 0)) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    // By its full path, as recorded in "# mlcc options", and only once
+    char *full = realpath(path, NULL);
+    if (!full) {
+        full = strdup(path);
+    }
+    for (int ix = 0;  (ix < num_catalogs);  ix++) {
+        if (!strcmp(catalogs[ix].path, full)) {
+            close(fd);
+            free(full);
+            return;
         }
     }
-    sort_set_by_label_and_remove_duplicates(selected_set, &num_selected);
-    sort_set_by_po_num(selected_set, &num_selected);
-    sort_set_by_label_and_remove_duplicates(available_set, &num_available);
+    size_t len = sb.st_size;
+    if (num_catalogs >= MAX_CATALOGS) {
+        fprintf(stderr, "More than %d catalogs\n", MAX_CATALOGS);
+        exit(EXIT_FAILURE);
+    }
+    if (len < sizeof(struct catalog_header)) {
+        fprintf(stderr, "%s is not an mlcc catalog\n", path);
+        exit(EXIT_FAILURE);
+    }
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    struct catalog_data *c = &(catalogs[num_catalogs]);
+    const struct catalog_header *h = map;
+    int ok = !memcmp(h->magic, CATALOG_MAGIC, sizeof(h->magic))
+        && (h->num_buckets > 0) && (h->strings_len > 0)
+        && catalog_range_ok(len, h->pkgs_offset, (uint64_t)h->num_pkgs * sizeof(struct catalog_pkg))
+        && catalog_range_ok(len, h->buckets_offset, (uint64_t)h->num_buckets * sizeof(uint32_t))
+        && catalog_range_ok(len, h->deps_offset, (uint64_t)h->num_deps * sizeof(struct catalog_dep))
+        && catalog_range_ok(len, h->strings_offset, h->strings_len)
+        && (((char *)map)[h->strings_offset + h->strings_len - 1] == '\0');
+    if (ok) {
+        c->path = full;
+        c->len = len;
+        c->header = h;
+        c->pkgs = (void *)((char *)map + h->pkgs_offset);
+        c->buckets = (void *)((char *)map + h->buckets_offset);
+        c->deps = (void *)((char *)map + h->deps_offset);
+        c->strings = (char *)map + h->strings_offset;
+    }
+    // Every offset stays in the file, and a hash chain only goes back, so
+    // it ends
+    for (uint32_t ix = 0;  ok && (ix < h->num_buckets);  ix++) {
+        ok = (c->buckets[ix] <= h->num_pkgs);
+    }
+    for (uint32_t ix = 0;  ok && (ix < h->num_pkgs);  ix++) {
+        const struct catalog_pkg *p = &(c->pkgs[ix]);
+        ok = (p->label < h->strings_len) && (p->desc < h->strings_len) && (p->frag < h->strings_len)
+            && (p->first_dep <= h->num_deps) && (p->num_deps <= (h->num_deps - p->first_dep))
+            && (p->next <= ix);
+    }
+    for (uint32_t ix = 0;  ok && (ix < h->num_deps);  ix++) {
+        ok = (c->deps[ix].label < h->strings_len);
+    }
+    if (!ok) {
+        fprintf(stderr, "%s is not a valid mlcc catalog\n", path);
+        exit(EXIT_FAILURE);
+    }
+    num_catalogs++;
+    for (uint32_t ix = 0;  (ix < h->num_pkgs);  ix++) {
+        const struct catalog_pkg *p = &(c->pkgs[ix]);
+        struct pkg_data pkg = { p->po_num, 0, (char *)c->strings + p->label,
+            (char *)c->strings + p->desc, (char *)c->strings + p->frag };
+        add_catalog_pkg(&pkg);
+    }
+    if (debug) {
+        printf("Catalog %s: %u pkgs\n", path, h->num_pkgs);
+    }
 }
 
 
-void mark_selection(char *s, int yes_or_no) {
-    int tokens_found = 0;
-    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
-        if (!strcasecmp(s, pkgs[ix].label)) {
-            pkgs[ix].include = yes_or_no;
-            num_selected += yes_or_no;
-            tokens_found += 1;
-            if (debug) {
-                printf("Marking pkg: %s as %d\n", pkgs[ix].label, yes_or_no);
-            }
-        }
+// Back to just the built in pkgs
+void unload_catalogs() {
+    for (int ix = 0;  (ix < num_catalogs);  ix++) {
+        munmap((void *)catalogs[ix].header, catalogs[ix].len);
+        free(catalogs[ix].path);
     }
-    if (!tokens_found) {
-        fprintf(stderr, "Token %s not found\n", s);
+    num_catalogs = 0;
+    init_pkgs();
+}
+
+
+void load_catalogs(char *paths) {
+    char *buf = strdup(paths);
+    char *save = NULL;
+    for (char *p = strtok_r(buf, ":", &save);  p;  p = strtok_r(NULL, ":", &save)) {
+        load_catalog(p);
     }
 }
 
 
-void clear_all_selections_in_po_num_group(int po_num) {
-    int lo = 100 * (po_num / 100);
-    int hi = 100 * ((po_num + 99) / 100);
-    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
-        if ((pkgs[ix].po_num >= lo) && (pkgs[ix].po_num < hi)) {
-            pkgs[ix].include = 0;
+uint32_t add_catalog_string(FILE *f, char *s) {
+    uint32_t offset = ftell(f);
+    fputs(s, f);
+    fputc('\0', f);
+    return offset;
+}
+
+
+int add_catalog_deps(FILE *f, struct catalog_pkg *p, struct catalog_dep *deps, char *list, int mark) {
+    for (char *d = strtok(list, list_delimiters);  d;  d = strtok(NULL, list_delimiters)) {
+        if ((p->first_dep + p->num_deps) >= MAX_CATALOG_DEPS) {
+            return -1;
         }
+        deps[p->first_dep + p->num_deps].label = add_catalog_string(f, d);
+        deps[p->first_dep + p->num_deps].mark = mark;
+        p->num_deps++;
     }
+    return 0;
 }
 
 
-int label_to_po_num(char *s) {
+int catalog_main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s catalog <out> <file>...\n", prog_name);
+        return EXIT_FAILURE;
+    }
+    static struct catalog_pkg cat[MAX_CATALOG_PKGS];
+    static struct catalog_dep deps[MAX_CATALOG_DEPS];
+    uint32_t num_cat = 0;
+    uint32_t num_deps = 0;
+    char *strings = NULL;
+    size_t strings_len = 0;
+    FILE *s = open_memstream(&strings, &strings_len);
+    // Offset 0 is ""
+    fputc('\0', s);
+    for (int ix = 2;  (ix < argc);  ix++) {
+        FILE *f = fopen(argv[ix], "r");
+        if (!f) {
+            perror(argv[ix]);
+            return EXIT_FAILURE;
+        }
+        struct catalog_pkg *p = NULL;
+        char *frag = NULL;
+        size_t frag_len = 0;
+        FILE *m = NULL;
+        char *line = NULL;
+        size_t line_size = 0;
+        char *error = NULL;
+        int line_num = 0;
+        while (!error && (getline(&line, &line_size, f) >= 0)) {
+            line_num++;
+            line[strcspn(line, "\n")] = '\0';
+            if (m) {
+                if (!strcmp(line, "end")) {
+                    fclose(m);
+                    m = NULL;
+                    p->frag = add_catalog_string(s, frag);
+                    free(frag);
+                } else {
+                    fprintf(m, "%s%s", frag_len ? "\n" : "", line);
+                    fflush(m);
+                }
+                continue;
+            }
+            char *key = line + strspn(line, " \t");
+            if (!*key || (*key == '#')) {
+                continue;
+            }
+            char *value = key + strcspn(key, " \t");
+            if (*value) {
+                *value++ = '\0';
+                value += strspn(value, " \t");
+            }
+            if (!strcmp(key, "pkg")) {
+                if (!*value || value[strcspn(value, list_delimiters)]) {
+                    error = "expecting pkg <label>";
+                } else if (num_cat >= MAX_CATALOG_PKGS) {
+                    error = "too many pkgs";
+                } else {
+                    p = &(cat[num_cat++]);
+                    p->po_num = -1;
+                    p->label = add_catalog_string(s, value);
+                    p->desc = 0;
+                    p->frag = 0;
+                    p->first_dep = num_deps;
+                    p->num_deps = 0;
+                }
+            } else if (!p) {
+                error = "expecting pkg <label> first";
+            } else if (!strcmp(key, "po")) {
+                p->po_num = atoi(value);
+                if ((p->po_num < 0) || (p->po_num >= MAX_PO_NUM_LIMIT)) {
+                    error = "po out of range";
+                }
+            } else if (!strcmp(key, "desc")) {
+                p->desc = add_catalog_string(s, value);
+            } else if (!strcmp(key, "requires") || !strcmp(key, "conflicts")) {
+                if (add_catalog_deps(s, p, deps, value, strcmp(key, "requires") ? 0 : 2) < 0) {
+                    error = "too many requires and conflicts";
+                }
+                num_deps = p->first_dep + p->num_deps;
+            } else if (!strcmp(key, "frag")) {
+                frag_len = 0;
+                m = open_memstream(&frag, &frag_len);
+            } else {
+                error = "unknown keyword";
+            }
+        }
+        if (!error && m) {
+            error = "frag without end";
+        }
+        if (!error && p && ((p->po_num < 0) || !p->frag)) {
+            error = "pkg without po or frag";
+        }
+        fclose(f);
+        free(line);
+        if (error) {
+            fprintf(stderr, "%s:%d: %s\n", argv[ix], line_num, error);
+            return EXIT_FAILURE;
+        }
+    }
+    fclose(s);
+    // Each pkg checked as it ends would miss the last of a file
+    for (uint32_t ix = 0;  (ix < num_cat);  ix++) {
+        if ((cat[ix].po_num < 0) || !cat[ix].frag) {
+            fprintf(stderr, "%s: pkg without po or frag\n", strings + cat[ix].label);
+            return EXIT_FAILURE;
+        }
+        for (uint32_t iy = 0;  (iy < ix);  iy++) {
+            if ((cat[iy].po_num == cat[ix].po_num) && !strcasecmp(strings + cat[iy].label, strings + cat[ix].label)) {
+                fprintf(stderr, "%s: pkg with po %d twice\n", strings + cat[ix].label, cat[ix].po_num);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    uint32_t num_buckets = (2 * num_cat) + 1;
+    uint32_t buckets[num_buckets];
+    memset(buckets, 0, sizeof(buckets));
+    for (uint32_t ix = 0;  (ix < num_cat);  ix++) {
+        uint32_t b = hash_label(strings + cat[ix].label) % num_buckets;
+        cat[ix].next = buckets[b];
+        buckets[b] = ix + 1;
+    }
+    struct catalog_header h = { CATALOG_MAGIC };
+    h.num_pkgs = num_cat;
+    h.num_buckets = num_buckets;
+    h.num_deps = num_deps;
+    h.pkgs_offset = sizeof(h);
+    h.buckets_offset = h.pkgs_offset + (num_cat * sizeof(cat[0]));
+    h.deps_offset = h.buckets_offset + (num_buckets * sizeof(buckets[0]));
+    h.strings_offset = h.deps_offset + (num_deps * sizeof(deps[0]));
+    h.strings_len = strings_len;
+    // Written aside and renamed into place, as an mlcc mapping the old one
+    // would fault on its pages changing under it
+    char name[1024];
+    snprintf(name, sizeof(name), "%s.tmp", argv[1]);
+    FILE *out = fopen(name, "w");
+    if (!out) {
+        perror(name);
+        return EXIT_FAILURE;
+    }
+    fwrite(&h, sizeof(h), 1, out);
+    fwrite(cat, sizeof(cat[0]), num_cat, out);
+    fwrite(buckets, sizeof(buckets[0]), num_buckets, out);
+    fwrite(deps, sizeof(deps[0]), num_deps, out);
+    fwrite(strings, 1, strings_len, out);
+    if (fclose(out) || rename(name, argv[1])) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    if (!quiet) {
+        printf("Wrote %s: %u pkgs, %u requires and conflicts, %zu bytes of strings\n",
+            argv[1], num_cat, num_deps, strings_len);
+    }
+    free(strings);
+    return EXIT_SUCCESS;
+}
+
+
+//
+// Source artifacts fetched by the fragments through /tmp/mlcc_fetch.sh and
+// /tmp/mlcc_git_clone.sh (see OS-Utils).  "mlcc -F" fills source_dir with the
+// artifacts of the selected pkgs (or of all pkgs when nothing is selected),
+// laid out like MLCC_Repos/NVIDIA_PKGS, and records their checksums in
+// SHA256SUMS there.  Git sources (ref != NULL) are stored as shallow tarballs
+// of the pinned ref named <repo>-<ref>.tar.gz, as mlcc_git_clone.sh expects.
+//
+
+struct src_data {
+    char *label;
+    char *file;
+    char *url;
+    char *ref;
+    int recursive;
+} srcs[] = {
+
+{ "CMake", "cmake-3.11.3.tar.gz", "https://cmake.org/files/v3.11/cmake-3.11.3.tar.gz", NULL, 0 },
+
+{ "Python2", "Python-2.7.15.tar.xz", "https://www.python.org/ftp/python/2.7.15/Python-2.7.15.tar.xz", NULL, 0 },
+{ "Python3", "Python-3.6.5.tar.xz", "https://www.python.org/ftp/python/3.6.5/Python-3.6.5.tar.xz", NULL, 0 },
+
+{ "GCC-5.3", "gcc-5.3.0.tar.gz", "https://ftp.gnu.org/gnu/gcc/gcc-5.3.0/gcc-5.3.0.tar.gz", NULL, 0 },
+{ "GCC-5.3", "gmp-6.1.0.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2", NULL, 0 },
+{ "GCC-5.3", "mpfr-3.1.4.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2", NULL, 0 },
+{ "GCC-5.3", "mpc-1.0.3.tar.gz", "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz", NULL, 0 },
+{ "GCC-5.3", "isl-0.16.1.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.16.1.tar.bz2", NULL, 0 },
+{ "GCC-5.3", "gcc-5.3.0-ec1cc026.patch", "https://gcc.gnu.org/git/?p=gcc.git;a=patch;h=ec1cc0263f156f70693a62cf17b254a0029f4852", NULL, 0 },
+
+{ "GCC-5.5", "gcc-5.5.0.tar.gz", "https://ftp.gnu.org/gnu/gcc/gcc-5.5.0/gcc-5.5.0.tar.gz", NULL, 0 },
+{ "GCC-5.5", "gmp-6.1.0.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2", NULL, 0 },
+{ "GCC-5.5", "mpfr-3.1.4.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2", NULL, 0 },
+{ "GCC-5.5", "mpc-1.0.3.tar.gz", "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz", NULL, 0 },
+{ "GCC-5.5", "isl-0.18.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2", NULL, 0 },
+
+{ "GCC-6.3", "gcc-6.3.0.tar.bz2", "https://ftp.gnu.org/gnu/gcc/gcc-6.3.0/gcc-6.3.0.tar.bz2", NULL, 0 },
+{ "GCC-6.3", "gmp-6.1.0.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2", NULL, 0 },
+{ "GCC-6.3", "mpfr-3.1.4.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2", NULL, 0 },
+{ "GCC-6.3", "mpc-1.0.3.tar.gz", "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz", NULL, 0 },
+{ "GCC-6.3", "isl-0.18.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2", NULL, 0 },
+
+{ "GCC-6.4", "gcc-6.4.0.tar.xz", "https://ftp.gnu.org/gnu/gcc/gcc-6.4.0/gcc-6.4.0.tar.xz", NULL, 0 },
+{ "GCC-6.4", "gmp-6.1.0.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2", NULL, 0 },
+{ "GCC-6.4", "mpfr-3.1.4.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2", NULL, 0 },
+{ "GCC-6.4", "mpc-1.0.3.tar.gz", "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz", NULL, 0 },
+{ "GCC-6.4", "isl-0.18.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2", NULL, 0 },
+
+{ "GCC-7.3", "gcc-7.3.0.tar.xz", "https://ftp.gnu.org/gnu/gcc/gcc-7.3.0/gcc-7.3.0.tar.xz", NULL, 0 },
+{ "GCC-7.3", "gmp-6.1.0.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/gmp-6.1.0.tar.bz2", NULL, 0 },
+{ "GCC-7.3", "mpfr-3.1.4.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/mpfr-3.1.4.tar.bz2", NULL, 0 },
+{ "GCC-7.3", "mpc-1.0.3.tar.gz", "https://gcc.gnu.org/pub/gcc/infrastructure/mpc-1.0.3.tar.gz", NULL, 0 },
+{ "GCC-7.3", "isl-0.18.tar.bz2", "https://gcc.gnu.org/pub/gcc/infrastructure/isl-0.18.tar.bz2", NULL, 0 },
+
+{ "MKL-DNN", "mkl-dnn-v0.14.tar.gz", "https://github.com/intel/mkl-dnn.git", "v0.14", 0 },
+
+{ "Bazel", "bazel-0.12.0-dist.zip", "https://github.com/bazelbuild/bazel/releases/download/0.12.0/bazel-0.12.0-dist.zip", NULL, 0 },
+{ "TensorFlow", "tensorflow-v1.8.0.tar.gz", "https://github.com/tensorflow/tensorflow.git", "v1.8.0", 0 },
+{ "OpenMPI", "openmpi-3.1.2.tar.bz2", "https://download.open-mpi.org/release/open-mpi/v3.1/openmpi-3.1.2.tar.bz2", NULL, 0 },
+
+{ "Julia", "julia-0.6.2-linux-x86_64.tar.gz", "https://julialang-s3.julialang.org/bin/linux/x64/0.6/julia-0.6.2-linux-x86_64.tar.gz", NULL, 0 },
+{ "R-studio", "rstudio-1.1.447-x86_64.rpm", "https://download1.rstudio.org/rstudio-1.1.447-x86_64.rpm", NULL, 0 },
+{ "rpud", "rpux_0.6.1_linux.tar.gz", "http://www.r-tutor.com/sites/default/files/rpud/rpux_0.6.1_linux.tar.gz", NULL, 0 },
+
+{ "Theano", "libgpuarray-v0.7.6.tar.gz", "https://github.com/Theano/libgpuarray.git", "v0.7.6", 0 },
+{ "Paddle", "Paddle-v0.12.0.tar.gz", "https://github.com/PaddlePaddle/Paddle.git", "v0.12.0", 0 },
+{ "Caffe", "caffe-1.0.tar.gz", "https://github.com/BVLC/caffe.git", "1.0", 0 },
+{ "Caffe2", "gflags-v2.2.1.tar.gz", "https://github.com/gflags/gflags.git", "v2.2.1", 0 },
+{ "Caffe2", "glog-v0.3.5.tar.gz", "https://github.com/google/glog.git", "v0.3.5", 0 },
+{ "Caffe2", "pytorch-v0.4.0.tar.gz", "https://github.com/pytorch/pytorch.git", "v0.4.0", 1 },
+{ "PyTorch-src", "pytorch-v0.4.0.tar.gz", "https://github.com/pytorch/pytorch.git", "v0.4.0", 1 },
+{ "OpenCV-src", "opencv-3.4.3.tar.gz", "https://github.com/opencv/opencv.git", "3.4.3", 0 }
+
+};
+#define NUM_SRCS (sizeof(srcs) / sizeof(srcs[0]))
+
+
+//
+// Toolchains which can be built once per fleet instead of once per image.
+// "mlcc -T" writes a <image>.Dockerfile for each selected (or every)
+// toolchain: the pkg's own fragment built on toolchain_base_os, with the
+// resulting /usr/local saved as prefix.  In the image Dockerfile, the pkg's
+// fragment is then replaced by frag, which COPYs that prefix from the
+// toolchain image.  Centos7 has the oldest glibc of the OS choices, so the
+// toolchains built on it run on all of them.
+//
+
+char *toolchain_base_os = "Centos7";
+
+struct toolchain_data {
+    char *label;
+    char *image;
+    char *prefix;
+    char *frag;
+} toolchains[] = {
+
+{ "CMake", "mlcc-toolchain-cmake-3.11", "/opt/cmake", BS(
+COPY --from=mlcc-toolchain-cmake-3.11 /opt/cmake /usr/local
+\nRUN cmake --version
+) },
+
+#if INCLUDE_GCC_5_3
+{ "GCC-5.3", "mlcc-toolchain-gcc-5.3", "/opt/gcc", BS(
+COPY --from=mlcc-toolchain-gcc-5.3 /opt/gcc /usr/local
+\nRUN cd /usr/local && if [ ! -e lib64 ]; then ln -s lib lib64; fi; ldconfig; gcc --version
+\nENV
+CC="/usr/local/bin/gcc"
+CXX="/usr/local/bin/g++"
+) },
+#endif
+
+{ "GCC-5.5", "mlcc-toolchain-gcc-5.5", "/opt/gcc", BS(
+COPY --from=mlcc-toolchain-gcc-5.5 /opt/gcc /usr/local
+\nRUN cd /usr/local && if [ ! -e lib64 ]; then ln -s lib lib64; fi; ldconfig; gcc --version
+\nENV
+CC="/usr/local/bin/gcc"
+CXX="/usr/local/bin/g++"
+) },
+
+#if INCLUDE_GCC_6_3
+{ "GCC-6.3", "mlcc-toolchain-gcc-6.3", "/opt/gcc", BS(
+COPY --from=mlcc-toolchain-gcc-6.3 /opt/gcc /usr/local
+\nRUN cd /usr/local && if [ ! -e lib64 ]; then ln -s lib lib64; fi; ldconfig; gcc --version
+\nENV
+CC="/usr/local/bin/gcc"
+CXX="/usr/local/bin/g++"
+) },
+#endif
+
+#if INCLUDE_GCC_6_4
+{ "GCC-6.4", "mlcc-toolchain-gcc-6.4", "/opt/gcc", BS(
+COPY --from=mlcc-toolchain-gcc-6.4 /opt/gcc /usr/local
+\nRUN cd /usr/local && if [ ! -e lib64 ]; then ln -s lib lib64; fi; ldconfig; gcc --version
+\nENV
+CC="/usr/local/bin/gcc"
+CXX="/usr/local/bin/g++"
+) },
+#endif
+
+{ "GCC-7.3", "mlcc-toolchain-gcc-7.3", "/opt/gcc", BS(
+COPY --from=mlcc-toolchain-gcc-7.3 /opt/gcc /usr/local
+\nRUN cd /usr/local && if [ ! -e lib64 ]; then ln -s lib lib64; fi; ldconfig; gcc --version
+\nENV
+CC="/usr/local/bin/gcc"
+CXX="/usr/local/bin/g++"
+) },
+
+{ "Bazel", "mlcc-toolchain-bazel-0.12", "/opt/bazel", BS( RUN
+/tmp/yum_install.sh java-1.8.0-openjdk java-1.8.0-openjdk-devel java-1.8.0-openjdk-headless
+\nCOPY --from=mlcc-toolchain-bazel-0.12 /opt/bazel /usr/local
+\nRUN bazel version
+) }
+
+};
+#define NUM_TOOLCHAINS (sizeof(toolchains) / sizeof(toolchains[0]))
+
+
+//
+// With --inference, the Dockerfile is a mlcc-build stage, as usual, and then
+// a runtime stage on the same OS with nothing but what is needed to serve.
+// At the end of mlcc-build, inference_collect_frag stages that under
+// /opt/mlcc/runtime-root: /opt/mlcc/serving, the Python wheels it keeps
+// installed into /opt/mlcc/serving/python, the libraries its binaries and
+// extension modules link from /usr/local or /opt (or that no rpm owns), the
+// names of the rpms owning the rest for the runtime stage to install, and a
+// source built Python without site-packages.
+// The runtime stage copies that tree and runs mlcc_serve, which starts
+// tensorflow_model_server (when there), runs the warmup.d hooks and then
+// marks the container ready for the HEALTHCHECK.
+//
+
+char *inference_collect_frag = BS( RUN
+R=/opt/mlcc/runtime-root;
+mkdir -p $R/usr/local/bin $R/usr/local/lib $R/opt/mlcc;
+if [ -x /usr/local/bin/python ]; then
+    cp -a /usr/local/bin/python* $R/usr/local/bin/ && cp -a /usr/local/lib/libpython* $R/usr/local/lib/ &&
+    cd /usr/local/lib && tar --exclude=site-packages --exclude=test -cf - python[23].* | tar -xf - -C $R/usr/local/lib &&
+    mkdir -p `echo $R/usr/local/lib/python[23].*`/site-packages;
+fi;
+cp -a /opt/mlcc/serving $R/opt/mlcc/ && /bin/rm -rf $R/opt/mlcc/serving/wheels;
+if ls "/opt/mlcc/serving/wheels/"*.whl; then
+    pip install --target $R/opt/mlcc/serving/python "/opt/mlcc/serving/wheels/"*.whl;
+fi;
+for BIN in "/opt/mlcc/serving/bin/"* `find $R/opt/mlcc/serving -type f -name "*.so*"`; do
+    ldd $BIN 2>/dev/null | awk '$3 ~ "^/" { print $3 }';
+done | sort -u > /tmp/mlcc_runtime_libs;
+grep -E "^/usr/local/|^/opt/" /tmp/mlcc_runtime_libs | xargs -r cp -L -t $R/usr/local/lib/;
+for LIB in `grep -v -E "^/usr/local/|^/opt/" /tmp/mlcc_runtime_libs`; do
+    if rpm -q -f $LIB > /dev/null 2>&1; then
+        rpm -q -f --qf "%{NAME} " $LIB;
+    else
+        cp -L -t $R/usr/local/lib/ $LIB;
+    fi;
+done > $R/opt/mlcc/runtime-rpms;
+echo -e '\
+#!/bin/bash \n\
+S=/opt/mlcc/serving \n\
+if [ -x $S/bin/tensorflow_model_server ]; then \n\
+    $S/bin/tensorflow_model_server --port=8500 --rest_api_port=8501 \
+--model_name=${MLCC_MODEL_NAME:-half_plus_two} --model_base_path=${MLCC_MODEL_BASE_PATH:-$S/models/half_plus_two} & \n\
+fi \n\
+for HOOK in $S/warmup.d/*; do \n\
+    [ -x $HOOK ] && $HOOK \n\
+done \n\
+touch /tmp/mlcc-ready \n\
+if [ $# -gt 0 ]; then exec "$@"; fi \n\
+wait \n'
+>> $R/opt/mlcc/serving/bin/mlcc_serve;
+chmod +x $R/opt/mlcc/serving/bin/mlcc_serve
+);
+
+char *inference_runtime_frag = BS(
+ENV PATH=/opt/mlcc/serving/bin:$PATH PYTHONPATH=/opt/mlcc/serving/python
+\nEXPOSE 8500 8501
+\nHEALTHCHECK CMD test -e /tmp/mlcc-ready
+\nCMD ["/opt/mlcc/serving/bin/mlcc_serve"]
+);
+
+
+//
+// Build profiles for the GCC-x.y pkgs, fastest first.  nvcc only needs a C
+// and C++ host compiler, so the default single stage C/C++ build is enough
+// for CUDA; "full" is the three stage bootstrap these pkgs used to do.
+//
+
+struct gcc_profile_data {
+    char *name;
+    char *desc;
+    char *configure_opts;
+} gcc_profiles[] = {
+{ "fast", "single stage, C/C++ only", "--disable-bootstrap --disable-multilib --enable-languages=c,c++" },
+{ "fortran", "single stage, C/C++/Fortran", "--disable-bootstrap --disable-multilib --enable-languages=c,c++,fortran" },
+{ "full", "three stage bootstrap, C/C++/Fortran", "--disable-multilib --enable-languages=c,c++,fortran" },
+};
+#define NUM_GCC_PROFILES (sizeof(gcc_profiles) / sizeof(gcc_profiles[0]))
+
+struct gcc_profile_data *gcc_profile = &(gcc_profiles[0]);
+
+
+//
+// Build profiles for the Python interpreter, when built from source.  The
+// default is the PGO build these pkgs have always done.
+//
+
+struct python_profile_data {
+    char *name;
+    char *desc;
+    char *configure_opts;
+} python_profiles[] = {
+{ "pgo", "profile guided optimization", "--enable-optimizations" },
+{ "lto-pgo", "link time and profile guided optimization", "--enable-optimizations --with-lto" },
+{ "fast", "no PGO run, quickest to build", "" },
+};
+#define NUM_PYTHON_PROFILES (sizeof(python_profiles) / sizeof(python_profiles[0]))
+
+struct python_profile_data *python_profile = &(python_profiles[0]);
+char *python_profile_task = NULL;
+
+
+//
+// The last step of every image precompiles the installed packages, so the
+// first import of each does not pay for it (and cannot fail to write the .pyc
+// as a non-root user).  It also installs mlcc_pybench, a pyperformance style
+// subset plus interpreter startup and "import tensorflow"/"import torch" (or
+// the modules given) cold start times, each in a fresh interpreter.
+//
+
+char *python_final_frag = BS( RUN
+python -c 'import compileall, sysconfig; [compileall.compile_dir(d, quiet=1) for d in set(sysconfig.get_path(p) for p in ("purelib", "platlib"))]';
+echo -e '\
+import json \n\
+import os \n\
+import pickle \n\
+import re \n\
+import subprocess \n\
+import sys \n\
+import time \n\
+def nbody(n=20000): \n\
+    x, y, vx, vy = 1.0, 0.0, 0.0, 0.5 \n\
+    for i in range(n): \n\
+        r = (x * x + y * y) ** 1.5 \n\
+        vx -= x / r * 0.01 \n\
+        vy -= y / r * 0.01 \n\
+        x += vx * 0.01 \n\
+        y += vy * 0.01 \n\
+def spectral_norm(n=60): \n\
+    a = lambda i, j: 1.0 / ((i + j) * (i + j + 1) / 2 + i + 1) \n\
+    u = [1.0] * n \n\
+    for k in range(5): \n\
+        v = [sum(a(i, j) * u[j] for j in range(n)) for i in range(n)] \n\
+        u = [sum(a(j, i) * v[j] for j in range(n)) for i in range(n)] \n\
+data = {"a": list(range(100)), "b": [{"c": "d" * 10, "e": 1.5}] * 50} \n\
+def json_dumps_loads(): \n\
+    for i in range(200): \n\
+        json.loads(json.dumps(data)) \n\
+def pickle_dumps_loads(): \n\
+    for i in range(200): \n\
+        pickle.loads(pickle.dumps(data, 2)) \n\
+text = "mlcc 2018-06-06 build 12345 foo@bar.com " * 200 \n\
+def regex(): \n\
+    for i in range(20): \n\
+        re.findall("[a-z]+@[a-z]+[.]com", text) \n\
+        re.sub("[0-9]+", "N", text) \n\
+def startup(): \n\
+    subprocess.call([sys.executable, "-c", "pass"]) \n\
+def bench(name, fn, runs=5): \n\
+    best = None \n\
+    for i in range(runs): \n\
+        t = time.time() \n\
+        fn() \n\
+        t = time.time() - t \n\
+        best = t if best is None else min(best, t) \n\
+    print("%-20s %9.2f ms" % (name, best * 1e3)) \n\
+print(sys.version.split()[0]) \n\
+for name, fn in [("nbody", nbody), ("spectral_norm", spectral_norm), ("json", json_dumps_loads), \
+("pickle", pickle_dumps_loads), ("regex", regex), ("startup", startup)]: \n\
+    bench(name, fn) \n\
+devnull = open(os.devnull, "w") \n\
+for mod in sys.argv[1:] or ["tensorflow", "torch"]: \n\
+    times = [] \n\
+    for i in range(3): \n\
+        t = time.time() \n\
+        if subprocess.call([sys.executable, "-c", "import " + mod], stderr=devnull): \n\
+            break \n\
+        times.append(time.time() - t) \n\
+    if times: \n\
+        print("%-20s %9.2f ms first, %.2f ms best" % ("import " + mod, times[0] * 1e3, min(times) * 1e3)) \n'
+>> /usr/local/bin/mlcc_pybench;
+sed -i "1i #!`command -v python`" /usr/local/bin/mlcc_pybench;
+chmod +x /usr/local/bin/mlcc_pybench
+);
+
+
+//
+// The "RUN python -c '<import>'" check closing a pkg fragment is not written
+// there, it is collected and run along with all the others in one step at
+// the end (see write_import_checks()).  mlcc_import_check imports each in a
+// fresh interpreter, as many at a time as there are CPUs, and records the
+// import time and peak RSS of each in /etc/mlcc/import-profile.json.  Any
+// import failing, or taking longer than MLCC_IMPORT_BUDGET_MS (when not 0),
+// fails the build.
+//
+// Each import also lists the files it loaded (modules and their .pyc, and
+// the shared libs mapped), which go, in import order, to
+// /etc/mlcc/prefetch.txt, which mlcc_prefetch reads (see --lazy-pull).
+//
+
+char *import_check_frag = BS( RUN
+mkdir -p /etc/mlcc;
+echo -e '\
+import json \n\
+import multiprocessing \n\
+import os \n\
+import subprocess \n\
+import sys \n\
+budget = float(os.environ.get("MLCC_IMPORT_BUDGET_MS") or 0) \n\
+child = ("import resource, sys, time; t = time.time(); exec(sys.argv[1]); t = time.time() - t; " \
+    "files = set(getattr(m, a, None) for m in list(sys.modules.values()) for a in (%r, %r)); " \
+    "files.update(l.split()[-1] for l in open(%r) if len(l.split()) > 5); " \
+    "print(chr(10).join(f for f in files if f)); " \
+    "print(t); print(resource.getrusage(resource.RUSAGE_SELF).ru_maxrss)") % ("__file__", "__cached__", "/proc/self/maps") \n\
+stmts = sys.argv[1:] \n\
+pending = list(stmts) \n\
+running = [] \n\
+imports = {} \n\
+touched = {} \n\
+failed = [] \n\
+while pending or running: \n\
+    while pending and len(running) < multiprocessing.cpu_count(): \n\
+        stmt = pending.pop(0) \n\
+        running.append((stmt, subprocess.Popen([sys.executable, "-c", child, stmt], \
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE))) \n\
+    stmt, p = running.pop(0) \n\
+    out, err = p.communicate() \n\
+    if p.returncode: \n\
+        sys.stderr.write(err.decode()) \n\
+        failed.append(stmt) \n\
+        continue \n\
+    lines = out.decode().split() \n\
+    t, rss = lines[-2:] \n\
+    touched[stmt] = sorted(f for f in lines[:-2] if f.startswith("/") and os.path.isfile(f)) \n\
+    imports[stmt] = {"ms": round(float(t) * 1e3, 1), "rss_kb": int(rss), "files": len(touched[stmt])} \n\
+over = [stmt for stmt in stmts if budget and stmt in imports and imports[stmt]["ms"] > budget] \n\
+for stmt in stmts: \n\
+    if stmt in imports: \n\
+        print("%-40s %9.1f ms %9d KB%s" % (stmt, imports[stmt]["ms"], imports[stmt]["rss_kb"], \
+            " over budget" if stmt in over else "")) \n\
+with open("/etc/mlcc/import-profile.json", "w") as f: \n\
+    json.dump({"python": sys.version.split()[0], "budget_ms": budget, "imports": imports}, f, indent=2, sort_keys=True) \n\
+seen = set() \n\
+with open("/etc/mlcc/prefetch.txt", "w") as f: \n\
+    for stmt in stmts: \n\
+        for path in touched.get(stmt, []): \n\
+            path = os.path.realpath(path) \n\
+            if path not in seen: \n\
+                seen.add(path) \n\
+                f.write(path + os.linesep) \n\
+if failed: \n\
+    sys.exit("import failed: " + ", ".join(failed)) \n\
+if over: \n\
+    sys.exit("over the %d ms import budget: %s" % (budget, ", ".join(over))) \n'
+>> /usr/local/bin/mlcc_import_check;
+sed -i "1i #!`command -v python`" /usr/local/bin/mlcc_import_check;
+chmod +x /usr/local/bin/mlcc_import_check
+);
+
+
+//
+// With --lazy-pull, mlcc_prefetch reads the files of /etc/mlcc/prefetch.txt
+// (when the import checks wrote one), to pull them ahead of first use.  With
+// a command, it does so in the background and runs the command, so it can
+// be the ENTRYPOINT.
+//
+
+char *prefetch_frag = BS( RUN
+echo -e '\
+#!/bin/bash \n\
+LIST=/etc/mlcc/prefetch.txt \n\
+prefetch() { [ -s $LIST ] && xargs -a $LIST -P 8 -n 64 cat > /dev/null 2>&1; } \n\
+if [ $# -eq 0 ]; then \n\
+    prefetch \n\
+    exit 0 \n\
+fi \n\
+prefetch & \n\
+exec "$@" \n'
+>> /usr/local/bin/mlcc_prefetch;
+chmod +x /usr/local/bin/mlcc_prefetch
+);
+
+
+//
+// CUDA compute capabilities (major * 10 + minor) to build kernels for.  Each
+// gets SASS, so the listed GPUs never JIT at load time; with cuda_ptx the
+// highest also gets PTX as the fallback for newer GPUs.  After the CUDA
+// fragment, these are written as ENV in the forms the fragments use:
+//   MLCC_CUDA_ARCH       "6.1,7.0"            (TensorFlow)
+//   TORCH_CUDA_ARCH_LIST "6.1;7.0+PTX"        (PyTorch, Caffe2, Torch)
+//   MLCC_CUDA_ARCH_BIN   "61 70"              (Paddle, with MLCC_CUDA_ARCH_PTX)
+//   MLCC_CUDA_GENCODE    "-gencode arch=..."  (Caffe)
+// libgpuarray, CuPy and the prebuilt wheels compile for the GPU at hand.
+//
+
+#define MAX_CUDA_ARCHS 16
+#define DEFAULT_CUDA_ARCHS { 52, 60, 61, 70 }
+int cuda_archs[MAX_CUDA_ARCHS] = DEFAULT_CUDA_ARCHS;
+int num_cuda_archs = 4;
+int cuda_archs_given = 0;
+int cuda_ptx = 1;
+
+struct cuda_version_data {
+    char *label;
+    int max_arch;
+} cuda_versions[] = {
+{ "CUDA8.0", 62 },
+{ "CUDA9.0", 70 },
+{ "CUDA9.1", 70 },
+{ "CUDA9.2", 70 },
+};
+#define NUM_CUDA_VERSIONS (sizeof(cuda_versions) / sizeof(cuda_versions[0]))
+
+
+struct pkg_data *selected_set[MAX_PKGS];
+struct pkg_data *available_set[MAX_PKGS];
+int num_selected = 0;
+int num_available = 0;
+
+
+void list_all_packages() {
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        printf("(%d) %s: %s\n", ix, pkgs[ix].label, pkgs[ix].desc);
+    }
+}
+
+
+void display_set(char *title, struct pkg_data **set, int *num, int lo_po_num_start, int hi_po_num_limit) {
+    struct winsize win_info;
+    ioctl(0, TIOCGWINSZ, &win_info);
+    // printf ("lines %d\n", win_info.ws_row);
+    // printf ("columns %d\n", win_info.ws_col);
+    printf("\n%s:\n", title);
+    int line_length = 0;
+    for (int ix = 0;  (ix < *num);  ix++) {
+        if ((set[ix]->po_num >= lo_po_num_start) && (set[ix]->po_num < hi_po_num_limit)) {
+            printf("%2d: %-20s", ix, set[ix]->label);
+            line_length += 24;
+            if (line_length +24  > win_info.ws_col) {
+                line_length = 0;
+                printf("\n");
+            }
+        }
+    }
+    printf("\n");
+}
+
+
+void sort_set_by_label_and_remove_duplicates(struct pkg_data **set, int *num) {
+    int n = *num;
+    for (int ix = 0;  (ix < n);  ix++) {
+        for (int iy = ix + 1;  (iy < n);  iy++) {
+            int different = strcasecmp(set[iy]->label, set[ix]->label);
+            if (!different) {
+                set[iy] = set[(n - 1)];
+                n -= 1;
+                iy -= 1;
+                continue;
+            } else if (different < 0) {
+                struct pkg_data *p = set[ix];
+                set[ix] = set[iy];
+                set[iy] = p;
+            }
+        }
+    }
+    *num = n;
+}
+
+
+void sort_set_by_po_num(struct pkg_data **set, int *num) {
+    int n = *num;
+    for (int ix = 0;  (ix < n);  ix++) {
+        for (int iy = ix + 1;  (iy < n);  iy++) {
+            if (set[iy]->po_num < set[ix]->po_num) {
+                struct pkg_data *p = set[ix];
+                set[ix] = set[iy];
+                set[iy] = p;
+            }
+        }
+    }
+    *num = n;
+}
+
+
+void add_to_set(struct pkg_data *p, struct pkg_data **set, int *n) {
+    set[*n] = p;
+    *n += 1;
+}
+
+
+//
+// The selection model.  A pkg's include only changes through
+// set_pkg_include(), which notes each pkg changed since the last
+// notify_selection_changes().  That then calls the observers (the UIs) for
+// just the pkgs whose include did end up different, so they update those
+// rather than look at every pkg after each change.
+//
+
+typedef void (*selection_observer)(struct pkg_data *p, int was);
+#define MAX_SELECTION_OBSERVERS 4
+selection_observer selection_observers[MAX_SELECTION_OBSERVERS];
+int num_selection_observers = 0;
+int changed_pkgs[MAX_PKGS];
+int changed_pkg_was[MAX_PKGS];
+char pkg_changed[MAX_PKGS];
+int num_changed_pkgs = 0;
+
+
+void add_selection_observer(selection_observer o) {
+    assert(num_selection_observers < MAX_SELECTION_OBSERVERS);
+    selection_observers[num_selection_observers++] = o;
+}
+
+
+void set_pkg_include(int ix, int include) {
+    if (pkgs[ix].include == include) {
+        return;
+    }
+    if (!pkg_changed[ix]) {
+        pkg_changed[ix] = 1;
+        changed_pkg_was[ix] = pkgs[ix].include;
+        changed_pkgs[num_changed_pkgs++] = ix;
+    }
+    pkgs[ix].include = include;
+}
+
+
+void notify_selection_changes() {
+    for (int ix = 0;  (ix < num_changed_pkgs);  ix++) {
+        int iy = changed_pkgs[ix];
+        pkg_changed[iy] = 0;
+        if (pkgs[iy].include != changed_pkg_was[iy]) {
+            for (int io = 0;  (io < num_selection_observers);  io++) {
+                selection_observers[io](&(pkgs[iy]), changed_pkg_was[iy]);
+            }
+        }
+    }
+    num_changed_pkgs = 0;
+}
+
+
+int selected(char *s) {
     for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
         if (!strcasecmp(s, pkgs[ix].label)) {
-            return pkgs[ix].po_num;
+            return pkgs[ix].include;
+        }
+    }
+    return 0;
+}
+
+
+void mark_label(char *s, int yes_or_no) {
+    int tokens_found = 0;
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if (!strcasecmp(s, pkgs[ix].label)) {
+            set_pkg_include(ix, yes_or_no);
+            num_selected += yes_or_no;
+            tokens_found += 1;
+            if (debug) {
+                printf("Marking pkg: %s as %d\n", pkgs[ix].label, yes_or_no);
+            }
+        }
+    }
+    if (!tokens_found) {
+        fprintf(stderr, "Token %s not found\n", s);
+    }
+}
+
+
+//
+// A catalog pkg's requires and conflicts apply whenever it is selected,
+// whether picked or pulled in, and so do those of what it pulls in.  A
+// conflict goes both ways: selecting a pkg drops what it conflicts with,
+// and what conflicts with it.  Requires that conflict with each other are
+// an error in the catalogs.
+//
+
+const struct catalog_pkg *find_catalog_pkg(char *s, struct catalog_data **cp) {
+    // The last catalog with the pkg wins, as with its frag
+    for (int ix = num_catalogs - 1;  (ix >= 0);  ix--) {
+        struct catalog_data *c = &(catalogs[ix]);
+        uint32_t next = c->buckets[hash_label(s) % c->header->num_buckets];
+        while (next) {
+            const struct catalog_pkg *p = &(c->pkgs[next - 1]);
+            if (!strcasecmp(s, c->strings + p->label)) {
+                *cp = c;
+                return p;
+            }
+            next = p->next;
+        }
+    }
+    return NULL;
+}
+
+
+void drop_catalog_conflict(char *s, char *conflict, char **added, int num_added) {
+    if (!selected(conflict)) {
+        return;
+    }
+    for (int ix = 0;  (ix < num_added);  ix++) {
+        if (!strcasecmp(added[ix], conflict)) {
+            fprintf(stderr, "Cannot select %s: it needs %s and %s, which conflict\n", added[0], s, conflict);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Nor drop what another selected pkg requires
+    for (int ix = 0;  (ix < num_catalogs);  ix++) {
+        struct catalog_data *c = &(catalogs[ix]);
+        for (uint32_t iy = 0;  (iy < c->header->num_pkgs);  iy++) {
+            struct catalog_data *w = NULL;
+            char *label = (char *)c->strings + c->pkgs[iy].label;
+            if (!selected(label) || (find_catalog_pkg(label, &w) != &(c->pkgs[iy]))) {
+                continue;
+            }
+            for (uint32_t iz = c->pkgs[iy].first_dep;  (iz < (c->pkgs[iy].first_dep + c->pkgs[iy].num_deps));  iz++) {
+                if (c->deps[iz].mark && !strcasecmp(conflict, c->strings + c->deps[iz].label)) {
+                    fprintf(stderr, "Cannot select %s: %s conflicts with %s, which %s needs\n", added[0], s, conflict, label);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+    mark_label(conflict, 0);
+}
+
+
+void mark_catalog_deps(char *s) {
+    char *added[MAX_PKGS];
+    int num_added = 0;
+    added[num_added++] = s;
+    for (int done = 0;  (done < num_added);  done++) {
+        char *a = added[done];
+        struct catalog_data *c = NULL;
+        const struct catalog_pkg *p = find_catalog_pkg(a, &c);
+        for (uint32_t iy = (p ? p->first_dep : 0);  p && (iy < (p->first_dep + p->num_deps));  iy++) {
+            char *dep = (char *)c->strings + c->deps[iy].label;
+            if (c->deps[iy].mark == 0) {
+                drop_catalog_conflict(a, dep, added, num_added);
+            } else if (!selected(dep) && (num_added < MAX_PKGS)) {
+                mark_label(dep, c->deps[iy].mark);
+                added[num_added++] = dep;
+            }
+        }
+        for (int ix = 0;  (ix < num_catalogs);  ix++) {
+            c = &(catalogs[ix]);
+            for (uint32_t iy = 0;  (iy < c->header->num_pkgs);  iy++) {
+                struct catalog_data *w = NULL;
+                char *label = (char *)c->strings + c->pkgs[iy].label;
+                if (find_catalog_pkg(label, &w) != &(c->pkgs[iy])) {
+                    continue;
+                }
+                for (uint32_t iz = c->pkgs[iy].first_dep;  (iz < (c->pkgs[iy].first_dep + c->pkgs[iy].num_deps));  iz++) {
+                    if ((c->deps[iz].mark == 0) && !strcasecmp(a, c->strings + c->deps[iz].label)) {
+                        drop_catalog_conflict(a, label, added, num_added);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+void mark_selection(char *s, int yes_or_no) {
+    int was = selected(s);
+    mark_label(s, yes_or_no);
+    if (yes_or_no && !was && num_catalogs) {
+        mark_catalog_deps(s);
+    }
+}
+
+
+void clear_all_selections_in_po_num_group(int po_num) {
+    int lo = 100 * (po_num / 100);
+    int hi = 100 * ((po_num + 99) / 100);
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if ((pkgs[ix].po_num >= lo) && (pkgs[ix].po_num < hi)) {
+            set_pkg_include(ix, 0);
+        }
+    }
+}
+
+
+int label_to_po_num(char *s) {
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if (!strcasecmp(s, pkgs[ix].label)) {
+            return pkgs[ix].po_num;
+        }
+    }
+    return -1;
+}
+
+
+int selected_strn(char *s, int n) {
+    int result = 0;
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if (!strncasecmp(s, pkgs[ix].label, n)) {
+            result |= pkgs[ix].include;
+        }
+    }
+    return result;
+}
+
+
+void check_dali_accelerator() {
+    if (selected("DALI") && selected("CPU")) {
+        fprintf(stderr, "DALI needs a CUDA accelerator, dropping it\n");
+        mark_selection("DALI", 0);
+    }
+}
+
+
+void check_compatibility_and_add(char *s) {
+    int po_num = label_to_po_num(s);
+    if ((po_num >= 0) && (po_num < MISC_LO_PO_NUM_START)) {
+        clear_all_selections_in_po_num_group(po_num);
+    }
+    if (!strncasecmp(s, "spaCy", 5)) {
+        mark_selection("Thinc", 2);
+    }
+    if (!strncasecmp(s, "R-studio", 8)) {
+        mark_selection("R", 2);
+    }
+    if ((!strncasecmp(s, "Caffe", 5)
+        || (!strncasecmp(s, "Caffe2", 6)))) {
+        mark_selection("Numpy", 2);
+        mark_selection("Atlas", 2);
+        mark_selection("OpenBLAS", 2);
+    }
+    if (!strncasecmp(s, "CNTK", 4)) {
+        mark_selection("Numpy", 2);
+        mark_selection("Scipy", 2);
+    }
+    if (!strncasecmp(s, "TensorFlow", 10)) {
+        mark_selection("Numpy", 2);
+        mark_selection("Bazel", 2);
+    }
+    if (!strncasecmp(s, "Paddle", 6)) {
+        mark_selection("Numpy", 2);
+    }
+    if (!strncasecmp(s, "Dask", 4)) {
+        mark_selection("Numpy", 2);
+        mark_selection("Pandas", 2);
+    }
+    if (!strncasecmp(s, "Ray", 3)) {
+        mark_selection("Numpy", 2);
+    }
+    if (!strncasecmp(s, "TF-Serving", 10)) {
+        mark_selection("Bazel", 2);
+    }
+    if (!strncasecmp(s, "ONNX-Runtime", 12)) {
+        mark_selection("Numpy", 2);
+    }
+    if ((!strncasecmp(s, "OpenMPI", 7))
+        || (!strncasecmp(s, "Horovod", 7))) {
+        mark_selection("Numpy", 2);
+        mark_selection("OpenMPI", 2);
+    }
+    // Only one way to get torch
+    if ((!strncasecmp(s, "PyTorch-src", 11))
+        || (!strncasecmp(s, "Nnpack", 6))) {
+        mark_selection("PyTorch", 0);
+        mark_selection("PyTorch-src", 2);
+        mark_selection("Numpy", 2);
+        mark_selection("MKL-DNN", 2);
+    } else if (!strncasecmp(s, "PyTorch", 7)) {
+        mark_selection("PyTorch-src", 0);
+    }
+    if (!strncasecmp(s, "OpenCV-src", 10)) {
+        mark_selection("OpenCV", 0);
+        mark_selection("Numpy", 2);
+    } else if (!strncasecmp(s, "OpenCV", 6)) {
+        mark_selection("OpenCV-src", 0);
+    }
+    if ((!strncasecmp(s, "Scikit", 6)
+        || (!strncasecmp(s, "Theano", 6)))) {
+        mark_selection("Numpy", 2);
+        mark_selection("Scipy", 2);
+        mark_selection("Cython", 2);
+    }
+    if (!strncasecmp(s, "Seaborn", 7)) {
+        mark_selection("Numpy", 2);
+        mark_selection("Scipy", 2);
+        mark_selection("Pandas", 2);
+        mark_selection("Matplotlib", 2);
+    }
+    if ((!strncasecmp(s, "R-studio", 8))
+        || (!strncasecmp(s, "Spyder", 6))
+        || (!strncasecmp(s, "Octave", 6))
+        || (!strncasecmp(s, "Matplotlib", 10))
+        || (!strncasecmp(s, "Seaborn", 7))) {
+        mark_selection("VNC", 2);
+    }
+    mark_selection(s, 1);
+    if (selected_strn("CUDA", 4)) {
+        if (selected("Chainer") || selected("spaCy") || selected("Thinc")) {
+            mark_selection("CuPy", 2);
+        }
+    }
+    if ( selected_strn("RHEL", 4) || selected_strn("Centos", 6) || selected_strn("Fedora", 6) ) {
+        mark_selection("OS-Utils", 2);
+        mark_selection("CMake", 2);
+    }
+    if (selected_strn("Fedora", 6)) {
+        // CUDA needs older GCC compilers:
+        // - CUDA8.0 needs GCC 5 or older
+        // - CUDA9.0 needs GCC 6 or older
+        // - CUDA9.1 needs GCC 6 or older
+        // - CUDA9.2 needs GCC 7 or older
+        if (selected("CUDA8.0")) {
+            mark_selection("GCC-5.5", 2);
+        } else if (selected("CUDA9.0") || selected("CUDA9.1")) {
+            if (!selected("Fedora25")) {
+                // Could use GCC 6 here, if working. Wait for GCC6.5?
+                mark_selection("GCC-5.5", 2);
+            }
+        } else if (selected("CUDA9.2")) {
+            if (selected("Fedora28")) {
+                mark_selection("GCC-7.3", 2);
+            }
+        }
+    }
+    if ( selected("Jupyter") && selected("R") ) {
+        mark_selection("IRkernel", 2);
+    }
+}
+
+
+#ifdef GUI
+
+
+#include <gtk/gtk.h>
+#include <glib.h>
+
+int num_buttons = 0;
+int first_other_button = 0;
+GtkWidget *buttons[MAX_PKGS];
+GtkWidget *pkg_buttons[MAX_PKGS];
+GtkWidget *save_rhel72_button = NULL;
+GtkWidget *save_cpu_button = NULL;
+GtkWidget *save_python2_button = NULL;
+
+void handle_select_event(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
+    char *button_label = (char *)gtk_button_get_label(GTK_BUTTON(widget));
+    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
+        check_compatibility_and_add(button_label);
+    } else {
+        mark_selection((char *)button_label, 0);
+    }
+    notify_selection_changes();
+}
+
+void update_pkg_button(struct pkg_data *p, int was) {
+    GtkWidget *b = pkg_buttons[p - pkgs];
+    if (b) {
+        // Shown, not clicked, so no handle_select_event()
+        g_signal_handlers_block_by_func(b, handle_select_event, NULL);
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(b), (p->include > 0));
+        g_signal_handlers_unblock_by_func(b, handle_select_event, NULL);
+    }
+}
+
+void add_button(GtkWidget *b) {
+    buttons[num_buttons++] = b;
+    g_signal_connect(b, "clicked", G_CALLBACK(handle_select_event), NULL);
+}
+
+void handle_reset_event(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(save_rhel72_button), 1);
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(save_cpu_button), 1);
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(save_python2_button), 1);
+    for (int ix = first_other_button;  (ix < num_buttons);  ix++) {
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(buttons[ix]), 0);
+        mark_selection((char *)gtk_button_get_label(GTK_BUTTON(buttons[ix])), 0);
+    }
+    notify_selection_changes();
+}
+
+static gboolean handle_create_button(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
+    for (int ix = 0;  (ix < num_buttons);  ix++) {
+        if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(buttons[ix]))) {
+            check_compatibility_and_add((char *)gtk_button_get_label(GTK_BUTTON(buttons[ix])));
+        }
+    }
+    gtk_main_quit();
+    return(FALSE);
+} 
+
+static gboolean handle_destroy_event(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
+    gtk_main_quit();
+    exit(EXIT_SUCCESS);
+}
+
+
+void make_gui_choices() {
+
+    GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(window), title_string);
+    gtk_window_set_position(GTK_WINDOW(window), GTK_WIN_POS_CENTER);
+    g_signal_connect(G_OBJECT(window), "destroy", G_CALLBACK(handle_destroy_event), NULL);
+    // gtk_window_set_decorated(GTK_WINDOW(window), show_window_decorations);
+    // gtk_window_set_default_size(GTK_WINDOW(window), panel_width, panel_height);
+    // gtk_container_set_border_width(GTK_CONTAINER(window), 10);
+
+    GtkWidget *big_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_box_set_homogeneous(GTK_BOX(big_box), FALSE);
+    gtk_container_add(GTK_CONTAINER(window), big_box);
+
+    GtkWidget *os_box1 = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_box_pack_start(GTK_BOX(big_box), os_box1, TRUE, TRUE, 0);
+    GtkWidget *button = gtk_radio_button_new_with_label(NULL, "RHEL7.2");
+    add_button(button);
+    save_rhel72_button = button;
+    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "RHEL7.3");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "RHEL7.4");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "RHEL7.5");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Centos7");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
+
+    GtkWidget *os_box2 = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_box_pack_start(GTK_BOX(big_box), os_box2, TRUE, TRUE, 0);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Fedora25");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(os_box2), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Fedora26");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(os_box2), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Fedora27");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(os_box2), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Fedora28");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(os_box2), button, TRUE, FALSE, 2);
+
+    GtkWidget *separator = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
+    gtk_box_pack_start(GTK_BOX(big_box), separator, FALSE, TRUE, 0);
+
+    GtkWidget *accel_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_box_pack_start(GTK_BOX(big_box), accel_box, TRUE, TRUE, 0);
+    button = gtk_radio_button_new_with_label(NULL, "CPU");
+    add_button(button);
+    save_cpu_button = button;
+    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "CUDA8.0");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "CUDA9.0");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "CUDA9.1");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "CUDA9.2");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
+
+    separator = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
+    gtk_box_pack_start(GTK_BOX(big_box), separator, FALSE, TRUE, 0);
+
+    GtkWidget *python_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_box_pack_start(GTK_BOX(big_box), python_box, TRUE, TRUE, 0);
+    button = gtk_radio_button_new_with_label(NULL, "Python2");
+    add_button(button);
+    save_python2_button = button;
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button), TRUE);
+    gtk_box_pack_start(GTK_BOX(python_box), button, TRUE, FALSE, 2);
+    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Python3");
+    add_button(button);
+    gtk_box_pack_start(GTK_BOX(python_box), button, TRUE, FALSE, 2);
+
+    separator = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
+    gtk_box_pack_start(GTK_BOX(big_box), separator, FALSE, TRUE, 0);
+
+    GtkWidget *other_box = gtk_flow_box_new();
+    gtk_flow_box_set_min_children_per_line((GtkFlowBox *)other_box, 3);
+    gtk_flow_box_set_max_children_per_line((GtkFlowBox *)other_box, 4);
+    gtk_box_pack_start(GTK_BOX(big_box), other_box, TRUE, TRUE, 0);
+
+    num_available = 0;
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if (pkgs[ix].po_num >= MISC_LO_PO_NUM_START) {
+            add_to_set(&(pkgs[ix]), available_set, &num_available);
+        }
+    }
+    sort_set_by_label_and_remove_duplicates(available_set, &num_available);
+    first_other_button = num_buttons;
+    for (int ix = 0;  (ix < num_available);  ix++) {
+        GtkWidget *button = gtk_check_button_new_with_label(available_set[ix]->label);
+        add_button(button);
+        gtk_flow_box_insert((GtkFlowBox *)other_box, button, -1);
+        for (int iy = 0;  (iy < NUM_PKGS);  iy++) {
+            if (!strcasecmp(pkgs[iy].label, available_set[ix]->label)) {
+                pkg_buttons[iy] = button;
+            }
+        }
+    }
+    add_selection_observer(update_pkg_button);
+
+    separator = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
+    gtk_box_pack_start(GTK_BOX(big_box), separator, FALSE, TRUE, 0);
+
+    GtkWidget *control_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_box_pack_start(GTK_BOX(big_box), control_box, TRUE, TRUE, 0);
+
+    GtkWidget *quit_button = gtk_button_new_with_label("Quit");
+    g_signal_connect(quit_button, "clicked", G_CALLBACK(handle_destroy_event), NULL);
+    gtk_box_pack_start(GTK_BOX(control_box), quit_button, TRUE, FALSE, 2);
+
+    GtkWidget *reset_button = gtk_button_new_with_label("Reset");
+    g_signal_connect(reset_button, "clicked", G_CALLBACK(handle_reset_event), NULL);
+    gtk_box_pack_start(GTK_BOX(control_box), reset_button, TRUE, FALSE, 2);
+
+    GtkWidget *create_button = gtk_button_new_with_label("Create Dockerfile");
+    g_signal_connect(create_button, "clicked", G_CALLBACK(handle_create_button), NULL);
+    gtk_box_pack_start(GTK_BOX(control_box), create_button, TRUE, FALSE, 2);
+
+    gtk_widget_show_all(window);
+    gtk_main();
+
+}
+
+
+#endif
+
+
+//
+// The terminal UI shows one entry per label, the selected by po_num and then
+// label, and the available by label.  Both sets are kept sorted as the selection changes,
+// rather than partitioned and sorted again each time around, and are shown
+// again only when they change.
+//
+
+char pkg_label_shown_before[MAX_PKGS];
+int num_selected_shown = 0;
+int num_available_shown = 0;
+int interactive_changed = 1;
+
+
+void remove_from_set(struct pkg_data *p, struct pkg_data **set, int *n) {
+    for (int ix = 0;  (ix < *n);  ix++) {
+        if (set[ix] == p) {
+            memmove(&(set[ix]), &(set[ix + 1]), (*n - ix - 1) * sizeof(set[0]));
+            *n -= 1;
+            return;
+        }
+    }
+}
+
+
+void insert_into_set(struct pkg_data *p, struct pkg_data **set, int *n, int by_po_num) {
+    int at = *n;
+    for (;  (at > 0);  at--) {
+        int po_order = by_po_num ? (set[at - 1]->po_num - p->po_num) : 0;
+        if ((po_order < 0) || (!po_order && (strcasecmp(set[at - 1]->label, p->label) <= 0))) {
+            break;
+        }
+        set[at] = set[at - 1];
+    }
+    set[at] = p;
+    *n += 1;
+}
+
+
+void update_interactive_sets(struct pkg_data *p, int was) {
+    if (pkg_label_shown_before[p - pkgs] || (!was == !p->include)) {
+        return;
+    }
+    if (p->include) {
+        remove_from_set(p, available_set, &num_available_shown);
+        insert_into_set(p, selected_set, &num_selected_shown, 1);
+    } else {
+        remove_from_set(p, selected_set, &num_selected_shown);
+        insert_into_set(p, available_set, &num_available_shown, 0);
+    }
+    interactive_changed = 1;
+}
+
+
+void make_interactive_choices() {
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        for (int iy = 0;  (iy < ix) && !pkg_label_shown_before[ix];  iy++) {
+            pkg_label_shown_before[ix] = !strcasecmp(pkgs[iy].label, pkgs[ix].label);
+        }
+        if (!pkg_label_shown_before[ix]) {
+            if (pkgs[ix].include) {
+                insert_into_set(&(pkgs[ix]), selected_set, &num_selected_shown, 1);
+            } else {
+                insert_into_set(&(pkgs[ix]), available_set, &num_available_shown, 0);
+            }
+        }
+    }
+    notify_selection_changes();
+    add_selection_observer(update_interactive_sets);
+    for (;;) {
+        if (interactive_changed) {
+            interactive_changed = 0;
+            printf("\n");
+            display_set("Selected", selected_set, &num_selected_shown, 0, MAX_PO_NUM_LIMIT);
+            display_set("OS Choices", available_set, &num_available_shown, 0, ACCEL_LO_PO_NUM_START);
+            display_set("Accelerator Choices", available_set, &num_available_shown, ACCEL_LO_PO_NUM_START, ACCEL_HI_PO_NUM_LIMIT);
+            display_set("Python Choices", available_set, &num_available_shown, PYTHON_LO_PO_NUM_START, PYTHON_HI_PO_NUM_LIMIT);
+            display_set("Additional Packages", available_set, &num_available_shown, MISC_LO_PO_NUM_START, PARALLEL_LO_PO_NUM_START);
+            display_set("Parallel Compute Packages", available_set, &num_available_shown, PARALLEL_LO_PO_NUM_START, INPUT_LO_PO_NUM_START);
+            display_set("Input Pipeline Packages", available_set, &num_available_shown, INPUT_LO_PO_NUM_START, INFERENCE_LO_PO_NUM_START);
+            display_set("Inference Packages", available_set, &num_available_shown, INFERENCE_LO_PO_NUM_START, PROFILING_LO_PO_NUM_START);
+            display_set("Profiling Packages", available_set, &num_available_shown, PROFILING_LO_PO_NUM_START, MAX_PO_NUM_LIMIT);
+        }
+        printf("\n(A)dd, (R)emove, (C)reate Dockerfile, (Q)uit: ");
+        char buf[255]; 
+        char choice = 'A';
+        fgets(buf, 255, stdin);
+        if (!isdigit(buf[0])) {
+            choice = toupper(buf[0]);
+            if (choice == 'Q') {
+                exit(EXIT_FAILURE);
+            } else if (choice == 'C') {
+                // What main() looks at to write the Dockerfile
+                num_selected = num_selected_shown;
+                break;
+            } else if (choice == 'A') {
+                printf("Enter numbers to add: ");
+            } else if (choice == 'R') {
+                printf("Enter numbers to remove: ");
+            } else {
+                continue;
+            }
+            fgets(buf, 255, stdin);
+        }
+        // The numbers are of the sets as shown, so those change only after
+        char *p = strtok(buf, list_delimiters);
+        while (p) {
+            unsigned ix = atoi(p);
+            if ((choice == 'A') && (ix < num_available_shown)) {
+                check_compatibility_and_add(available_set[ix]->label);
+            } else if ((choice == 'R') && (ix < num_selected_shown)) {
+                mark_selection(selected_set[ix]->label, 0);
+            }
+            p = strtok(NULL, list_delimiters);
+        }
+        notify_selection_changes();
+    }
+}
+
+
+int source_needed(int ix) {
+    if (label_to_po_num(srcs[ix].label) < 0) {
+        // pkg not compiled into this mlcc
+        return 0;
+    }
+    if ((num_selected > 0) && !selected(srcs[ix].label)) {
+        return 0;
+    }
+    // Several pkgs share some artifacts, so only do the first one
+    for (int iy = 0;  (iy < ix);  iy++) {
+        if (!strcmp(srcs[iy].file, srcs[ix].file) && source_needed(iy)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+char *source_checksum(char *file, char *sum, int sum_len) {
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s/SHA256SUMS", source_dir);
+    FILE *f = fopen(buf, "r");
+    if (!f) {
+        return NULL;
+    }
+    char *result = NULL;
+    char format[32];
+    snprintf(format, sizeof(format), "%%%ds %%511s", sum_len - 1);
+    while (!result && fgets(buf, sizeof(buf), f)) {
+        char name[512];
+        if ((sscanf(buf, format, sum, name) == 2) && !strcmp(name, file)) {
+            result = sum;
+        }
+    }
+    fclose(f);
+    return result;
+}
+
+
+// The sums "mlcc -F" pinned for the selected pkgs, for mlcc_fetch.sh to
+// check upstream fetches
+void write_pinned_checksums(FILE *f) {
+    fprintf(f, "RUN touch /tmp/mlcc_sha256sums");
+    for (int ix = 0;  (ix < NUM_SRCS);  ix++) {
+        int seen = !selected(srcs[ix].label);
+        for (int iy = 0;  (iy < ix) && !seen;  iy++) {
+            seen = selected(srcs[iy].label) && !strcmp(srcs[iy].file, srcs[ix].file);
+        }
+        char sum[128];
+        if (!seen && source_checksum(srcs[ix].file, sum, sizeof(sum))) {
+            fprintf(f, "; echo \"%s  %s\" >> /tmp/mlcc_sha256sums", sum, srcs[ix].file);
+        }
+    }
+    fprintf(f, "\n");
+}
+
+
+void write_source_manifest(FILE *f) {
+    fprintf(f, "# mlcc source manifest: <file> <sha256> <url> <ref>\n");
+    for (int ix = 0;  (ix < NUM_SRCS);  ix++) {
+        if (source_needed(ix)) {
+            char sum[128];
+            char *p = source_checksum(srcs[ix].file, sum, sizeof(sum));
+            fprintf(f, "%s %s %s %s\n", srcs[ix].file, p ? p : "-", srcs[ix].url, srcs[ix].ref ? srcs[ix].ref : "-");
+        }
+    }
+}
+
+
+int fetch_sources() {
+    char cmd[4096];
+    int failures = 0;
+    snprintf(cmd, sizeof(cmd), "mkdir -p %s", source_dir);
+    if (system(cmd)) {
+        fprintf(stderr, "Cannot create %s\n", source_dir);
+        return 1;
+    }
+    for (int ix = 0;  (ix < NUM_SRCS);  ix++) {
+        if (!source_needed(ix)) {
+            continue;
+        }
+        struct src_data *s = &(srcs[ix]);
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", source_dir, s->file);
+        if (access(path, R_OK)) {
+            if (!quiet) {
+                printf("Fetching %s %s\n", s->url, s->ref ? s->ref : "");
+                fflush(stdout);
+            }
+            if (s->ref) {
+                snprintf(cmd, sizeof(cmd),
+                    "T=`mktemp -d` && git clone -q --depth 1 --branch '%s' %s '%s' $T/src && "
+                    "tar -czf '%s.part' -C $T/src . && mv '%s.part' '%s'; R=$?; /bin/rm -rf $T; exit $R",
+                    s->ref, s->recursive ? "--recursive" : "", s->url, path, path, path);
+            } else {
+                snprintf(cmd, sizeof(cmd), "wget -q -O '%s.part' '%s' && mv '%s.part' '%s'", path, s->url, path, path);
+            }
+            if (system(cmd)) {
+                fprintf(stderr, "Cannot fetch %s\n", s->url);
+                snprintf(cmd, sizeof(cmd), "/bin/rm -f '%s.part'", path);
+                system(cmd);
+                failures += 1;
+                continue;
+            }
+        }
+        char sum[128];
+        if (source_checksum(s->file, sum, sizeof(sum))) {
+            snprintf(cmd, sizeof(cmd), "cd %s && echo '%s  %s' | sha256sum -c --quiet -", source_dir, sum, s->file);
+            if (system(cmd)) {
+                fprintf(stderr, "Checksum mismatch for %s, removed it\n", path);
+                unlink(path);
+                failures += 1;
+            }
+        } else {
+            // First fetch of this artifact pins its checksum
+            snprintf(cmd, sizeof(cmd), "cd %s && sha256sum '%s' >> SHA256SUMS", source_dir, s->file);
+            if (system(cmd)) {
+                failures += 1;
+            }
+        }
+    }
+    return failures;
+}
+
+
+void set_python_profile(char *s) {
+    for (int ix = 0;  (ix < NUM_PYTHON_PROFILES);  ix++) {
+        if (!strcasecmp(s, python_profiles[ix].name)) {
+            python_profile = &(python_profiles[ix]);
+            return;
+        }
+    }
+    fprintf(stderr, "Unknown Python profile %s, expecting one of:\n", s);
+    for (int ix = 0;  (ix < NUM_PYTHON_PROFILES);  ix++) {
+        fprintf(stderr, "%s: %s\n", python_profiles[ix].name, python_profiles[ix].desc);
+    }
+    exit(EXIT_FAILURE);
+}
+
+
+void set_gcc_profile(char *s) {
+    for (int ix = 0;  (ix < NUM_GCC_PROFILES);  ix++) {
+        if (!strcasecmp(s, gcc_profiles[ix].name)) {
+            gcc_profile = &(gcc_profiles[ix]);
+            return;
+        }
+    }
+    fprintf(stderr, "Unknown GCC profile %s, expecting one of:\n", s);
+    for (int ix = 0;  (ix < NUM_GCC_PROFILES);  ix++) {
+        fprintf(stderr, "%s: %s\n", gcc_profiles[ix].name, gcc_profiles[ix].desc);
+    }
+    exit(EXIT_FAILURE);
+}
+
+
+void set_cuda_archs(char *s) {
+    char buf[256];
+    char *save = NULL;
+    snprintf(buf, sizeof(buf), "%s", s);
+    num_cuda_archs = 0;
+    cuda_archs_given = 1;
+    for (char *p = strtok_r(buf, list_delimiters, &save);  (p);  p = strtok_r(NULL, list_delimiters, &save)) {
+        int major = 0;
+        int minor = 0;
+        if (!strncasecmp(p, "sm_", 3) || !strncasecmp(p, "compute_", 8)) {
+            p = strchr(p, '_') + 1;
+        }
+        if ((sscanf(p, "%d.%d", &major, &minor) == 2) && (major < 10) && (minor < 10)) {
+            major = major * 10 + minor;
+        }
+        if ((major < 20) || (major > 99) || (num_cuda_archs >= MAX_CUDA_ARCHS)) {
+            fprintf(stderr, "Bad CUDA arch %s, expecting e.g. 6.1,7.0\n", p);
+            exit(EXIT_FAILURE);
+        }
+        // Keep them sorted, so the last one is the highest
+        int ix = num_cuda_archs++;
+        while ((ix > 0) && (cuda_archs[ix - 1] > major)) {
+            cuda_archs[ix] = cuda_archs[ix - 1];
+            ix -= 1;
+        }
+        cuda_archs[ix] = major;
+    }
+}
+
+
+void set_cuda_ptx(char *s) {
+    if (!strcasecmp(s, "yes") || !strcasecmp(s, "true") || !strcmp(s, "1")) {
+        cuda_ptx = 1;
+    } else if (!strcasecmp(s, "no") || !strcasecmp(s, "false") || !strcmp(s, "0")) {
+        cuda_ptx = 0;
+    } else {
+        fprintf(stderr, "Bad --cuda-ptx %s, expecting yes or no\n", s);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+void write_cuda_arch_env(FILE *f, char *cuda_label) {
+    int max_arch = 99;
+    for (int ix = 0;  (ix < NUM_CUDA_VERSIONS);  ix++) {
+        if (!strcasecmp(cuda_label, cuda_versions[ix].label)) {
+            max_arch = cuda_versions[ix].max_arch;
+        }
+    }
+    char tf[256] = "", torch[256] = "", bin[256] = "", gencode[1024] = "";
+    int n = 0;
+    int highest = 0;
+    for (int ix = 0;  (ix < num_cuda_archs);  ix++) {
+        int a = cuda_archs[ix];
+        if ((a > max_arch) || (a == highest)) {
+            // The default list covers newer GPUs than old CUDAs know
+            if ((a > max_arch) && cuda_archs_given) {
+                fprintf(stderr, "%s does not support CUDA arch %d.%d, skipping it\n", cuda_label, a / 10, a % 10);
+            }
+            continue;
+        }
+        char *sep = n++ ? "," : "";
+        snprintf(tf + strlen(tf), sizeof(tf) - strlen(tf), "%s%d.%d", sep, a / 10, a % 10);
+        snprintf(torch + strlen(torch), sizeof(torch) - strlen(torch), "%s%d.%d", *sep ? ";" : "", a / 10, a % 10);
+        snprintf(bin + strlen(bin), sizeof(bin) - strlen(bin), "%s%d", *sep ? " " : "", a);
+        snprintf(gencode + strlen(gencode), sizeof(gencode) - strlen(gencode),
+            "%s-gencode arch=compute_%d,code=sm_%d", *sep ? " " : "", a, a);
+        highest = a;
+    }
+    if (!n) {
+        fprintf(stderr, "No usable CUDA arch for %s\n", cuda_label);
+        exit(EXIT_FAILURE);
+    }
+    if (cuda_ptx) {
+        snprintf(torch + strlen(torch), sizeof(torch) - strlen(torch), "+PTX");
+        snprintf(gencode + strlen(gencode), sizeof(gencode) - strlen(gencode),
+            " -gencode arch=compute_%d,code=compute_%d", highest, highest);
+    }
+    fprintf(f, "ENV MLCC_CUDA_ARCH=\"%s\" TORCH_CUDA_ARCH_LIST=\"%s\" MLCC_CUDA_ARCH_BIN=\"%s\" ", tf, torch, bin);
+    if (cuda_ptx) {
+        fprintf(f, "MLCC_CUDA_ARCH_PTX=\"%d\" ", highest);
+    }
+    fprintf(f, "MLCC_CUDA_GENCODE=\"%s\"\n", gencode);
+}
+
+
+//
+// TensorFlow is built with --config=mkl when MKL or MKL-DNN is selected too,
+// and with the XLA JIT when asked for.  The resulting variant is recorded as
+// an image LABEL and in /etc/mlcc/tensorflow-build.
+//
+
+void write_tensorflow_args(FILE *f) {
+    int mkl = (selected("MKL") || selected("MKL-DNN"));
+    char build[64] = "";
+    if (selected_strn("CUDA", 4)) {
+        strcat(build, "+cuda");
+    }
+    if (mkl) {
+        strcat(build, "+mkl");
+    }
+    if (tf_xla) {
+        strcat(build, "+xla");
+    }
+    int mpi = (selected("OpenMPI") != 0);
+    if (mpi) {
+        strcat(build, "+mpi");
+    }
+    int gdr = (tf_verbs && selected_strn("CUDA", 4));
+    if (tf_verbs) {
+        strcat(build, gdr ? "+verbs+gdr" : "+verbs");
+    }
+    char *label = build[0] ? build + 1 : "default";
+    fprintf(f, "\nARG MLCC_TF_MKL=%d\nARG MLCC_TF_XLA=%d\nARG MLCC_TF_BUILD=\"%s\"\n", mkl, tf_xla, label);
+    fprintf(f, "ARG MLCC_TF_MPI=%d\nARG MLCC_TF_VERBS=%d\nARG MLCC_TF_GDR=%d\n", mpi, tf_verbs, gdr);
+    fprintf(f, "LABEL mlcc.tensorflow.build=\"%s\"\n", label);
+}
+
+
+//
+// Horovod is built for each selected framework and skips the others, with
+// NCCL allreduce on GPUs when CUDA is selected.
+//
+
+void write_horovod_args(FILE *f) {
+    char *frameworks[] = { "TENSORFLOW", "TensorFlow", "PYTORCH", "PyTorch", "MXNET", "Mxnet" };
+    fprintf(f, "\n");
+    for (int ix = 0;  (ix < 6);  ix += 2) {
+        // selected_strn() so PyTorch-src counts too
+        int with = selected_strn(frameworks[ix + 1], strlen(frameworks[ix + 1]));
+        fprintf(f, "ARG HOROVOD_%s_%s=1\n", with ? "WITH" : "WITHOUT", frameworks[ix]);
+    }
+    if (selected_strn("CUDA", 4)) {
+        fprintf(f, "ARG HOROVOD_GPU_ALLREDUCE=NCCL\nARG HOROVOD_NCCL_HOME=/usr/local/nccl\n");
+    }
+}
+
+
+//
+// PyTorch-src links the first of MKL, OpenBLAS and Atlas selected, and its
+// variant (also the name of its reusable wheel) spells out what it was built
+// for, e.g. "cuda9.2-sm61.70+ptx+mkldnn+nnpack+openblas+haswell", so a wheel
+// is only reused by a build that asked for the same.
+//
+
+void write_pytorch_args(FILE *f) {
+    char *blas = selected("MKL") ? "MKL" : selected("OpenBLAS") ? "OpenBLAS" : selected("Atlas") ? "ATLAS" : "";
+    char build[256] = "cpu";
+    for (int ix = 0;  (ix < NUM_CUDA_VERSIONS);  ix++) {
+        if (selected(cuda_versions[ix].label)) {
+            snprintf(build, sizeof(build), "cuda%s-sm", cuda_versions[ix].label + 4);
+            for (int iy = 0;  (iy < num_cuda_archs) && (cuda_archs[iy] <= cuda_versions[ix].max_arch);  iy++) {
+                snprintf(build + strlen(build), sizeof(build) - strlen(build), "%s%d", iy ? "." : "", cuda_archs[iy]);
+            }
+            if (cuda_ptx) {
+                snprintf(build + strlen(build), sizeof(build) - strlen(build), "+ptx");
+            }
+        }
+    }
+    snprintf(build + strlen(build), sizeof(build) - strlen(build), "+mkldnn+nnpack");
+    if (*blas) {
+        snprintf(build + strlen(build), sizeof(build) - strlen(build), "+%s", blas);
+    }
+    if (cpu_arch) {
+        snprintf(build + strlen(build), sizeof(build) - strlen(build), "+%s", cpu_arch);
+    }
+    for (char *c = build;  (*c);  c++) {
+        *c = tolower(*c);
+    }
+    fprintf(f, "\nARG MLCC_TORCH_BLAS=\"%s\"\nARG MLCC_TORCH_BUILD=\"%s\"\n", blas, build);
+    fprintf(f, "LABEL mlcc.pytorch.build=\"%s\"\n", build);
+}
+
+
+//
+// With -m, a time stamp follows each pkg fragment and the per-pkg deltas end
+// up in /etc/mlcc/build-times (and the build log).  Layers served from the
+// build cache show up as near zero.
+//
+
+#define IMPORT_CHECK_PREFIX "\nRUN python -c '"
+char import_checks[MAX_PKGS][128];
+int num_import_checks = 0;
+int import_budget_ms = 0;
+
+
+void write_frag_without_import_check(FILE *f, char *frag) {
+    char *check = strstr(frag, IMPORT_CHECK_PREFIX);
+    char *stmt = check ? check + strlen(IMPORT_CHECK_PREFIX) : NULL;
+    char *end = stmt ? strchr(stmt, '\'') : NULL;
+    if (!end || ((end - stmt) >= sizeof(import_checks[0])) || (num_import_checks >= MAX_PKGS)) {
+        fprintf(f, "\n%s\n", frag);
+        return;
+    }
+    snprintf(import_checks[num_import_checks++], sizeof(import_checks[0]), "%.*s", (int)(end - stmt), stmt);
+    fprintf(f, "\n%.*s%s\n", (int)(check - frag), frag, end + 1);
+}
+
+
+void write_prefetch_helper(FILE *f) {
+    if (!lazy_pull) {
+        return;
+    }
+    fprintf(f, "\n%s\n", prefetch_frag);
+    if (!strcmp(lazy_pull, "zstd:chunked") && !inference) {
+        // An ENTRYPOINT drops the CMD of the OS image
+        fprintf(f, "ENTRYPOINT [\"/usr/local/bin/mlcc_prefetch\"]\nCMD [\"/bin/bash\"]\n");
+    }
+}
+
+
+void write_import_checks(FILE *f) {
+    if (num_import_checks == 0) {
+        return;
+    }
+    fprintf(f, "\n%s\n", import_check_frag);
+    fprintf(f, "ARG MLCC_IMPORT_BUDGET_MS=%d\nRUN mlcc_import_check", import_budget_ms);
+    for (int ix = 0;  (ix < num_import_checks);  ix++) {
+        fprintf(f, " \"%s\"", import_checks[ix]);
+    }
+    fprintf(f, "\n");
+}
+
+
+//
+// With --slim, the last RUN of each pkg fragment from OS-Utils on also runs
+// mlcc_slim.sh, so what it strips and removes never lands in a layer.  It
+// only looks at files created since the previous pkg's cleanup, and reports
+// the bytes it accounts for as the estimate.  With -m it also measures the
+// layer's directories before and after, and /etc/mlcc/slim-bytes has both.
+//
+
+void write_frag_with_slim(FILE *f, char *frag, char *label) {
+    char *run = NULL;
+    for (char *s = strstr(frag, "RUN ");  s;  s = strstr(s + 4, "RUN ")) {
+        if ((s == frag) || (s[-1] == '\n')) {
+            run = s;
+        }
+    }
+    if (!run) {
+        fputs(frag, f);
+        return;
+    }
+    char *eol = strchr(run, '\n');
+    if (!eol) {
+        eol = run + strlen(run);
+    }
+    char *end = eol;
+    while ((end > run) && (isspace(end[-1]) || (end[-1] == ';'))) {
+        end--;
+    }
+    // Still failing the build when the pkg's own last command did
+    fprintf(f, "%.*s; R=$?; %s/tmp/mlcc_slim.sh %s; exit $R%s", (int)(end - frag), frag,
+        timing ? "MLCC_SLIM_MEASURE=1 " : "", label, eol);
+}
+
+
+void write_pkg_frag(FILE *f, struct pkg_data *p, char *frag) {
+    if (!strncasecmp(p->label, "GCC-", 4)) {
+        fprintf(f, "\nARG MLCC_GCC_CONFIGURE_OPTS=\"%s\"\n", gcc_profile->configure_opts);
+    }
+    if (!strncasecmp(p->label, "Python", 6)) {
+        fprintf(f, "\nARG MLCC_PYTHON_CONFIGURE_OPTS=\"%s\"\n", python_profile->configure_opts);
+        if (python_profile_task) {
+            fprintf(f, "ARG MLCC_PYTHON_PROFILE_TASK=\"%s\"\n", python_profile_task);
+        }
+    }
+    if (!strcasecmp(p->label, "TensorFlow")) {
+        write_tensorflow_args(f);
+    }
+    if (!strcasecmp(p->label, "PyTorch-src")) {
+        write_pytorch_args(f);
+    }
+    if (!strcasecmp(p->label, "Horovod")) {
+        write_horovod_args(f);
+    }
+    if ((p->po_num >= INFERENCE_LO_PO_NUM_START) && (p->po_num < PROFILING_LO_PO_NUM_START)) {
+        fprintf(f, "\nARG MLCC_SERVING_MKL=%d\n", (selected("MKL") || selected("MKL-DNN")));
+    }
+    if (slim && (p->po_num >= label_to_po_num("OS-Utils"))) {
+        char *buf = NULL;
+        size_t len = 0;
+        FILE *m = open_memstream(&buf, &len);
+        write_frag_without_import_check(m, frag);
+        fclose(m);
+        write_frag_with_slim(f, buf, p->label);
+        free(buf);
+    } else {
+        write_frag_without_import_check(f, frag);
+    }
+    if (!strcasecmp(p->label, "OS-Utils")) {
+        write_pinned_checksums(f);
+    }
+    if (!strcasecmp(p->label, "OS-Utils") && cpu_arch) {
+        fprintf(f, "ARG MLCC_CPU_ARCH=\"%s\"\n", cpu_arch);
+    }
+    if (!strncasecmp(p->label, "CUDA", 4)) {
+        write_cuda_arch_env(f, p->label);
+    }
+    if (timing) {
+        fprintf(f, "RUN mkdir -p /etc/mlcc && echo \"%s $(date +%%s)\" >> /etc/mlcc/build-stamps\n", p->label);
+    }
+}
+
+
+void write_inference_stage(FILE *f) {
+    if (!inference) {
+        return;
+    }
+    fprintf(f, "\n%s\n", inference_collect_frag);
+    if (lazy_pull) {
+        fprintf(f, "RUN cp -a /usr/local/bin/mlcc_prefetch /opt/mlcc/runtime-root/usr/local/bin/ && "
+            "if [ -e /etc/mlcc/prefetch.txt ]; then mkdir -p /opt/mlcc/runtime-root/etc/mlcc && "
+            "cp -a /etc/mlcc/prefetch.txt /opt/mlcc/runtime-root/etc/mlcc/; fi\n");
+    }
+    fprintf(f, "\n# mlcc inference runtime stage\n");
+    // The OS image and its repos again, but not OS-Utils and on
+    int os_utils_po_num = label_to_po_num("OS-Utils");
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if (pkgs[ix].include && (pkgs[ix].po_num < os_utils_po_num)) {
+            fprintf(f, "\n%s\n", pkgs[ix].frag);
+        }
+    }
+    // A system Python comes from the OS instead
+    char *python = selected("Python3") ? "python3" : "python2";
+    fprintf(f, "\nCOPY --from=mlcc-build /opt/mlcc/runtime-root/ /\n");
+    fprintf(f, "RUN echo /usr/local/lib > /etc/ld.so.conf.d/mlcc-runtime.conf && ldconfig; "
+        "if [ -s /opt/mlcc/runtime-rpms ]; then yum -y install `cat /opt/mlcc/runtime-rpms`; fi; "
+        "if [ ! -x /usr/local/bin/python ]; then "
+        "command -v %s || yum -y install %s; ln -sf %s /usr/bin/python; "
+        "fi; cd /var/cache && /bin/rm -rf dnf yum; python --version\n", python, python, python);
+    if (lazy_pull && !strcmp(lazy_pull, "zstd:chunked")) {
+        fprintf(f, "ENTRYPOINT [\"/usr/local/bin/mlcc_prefetch\"]\n");
+    }
+    fprintf(f, "%s\n", inference_runtime_frag);
+}
+
+
+void write_timing_summary(FILE *f) {
+    if (timing) {
+        fprintf(f, "\nRUN awk 'NR > 1 { print $1, $2 - t } { t = $2 }' /etc/mlcc/build-stamps > /etc/mlcc/build-times; "
+            "cat /etc/mlcc/build-times%s\n", slim ? "; cat /etc/mlcc/slim-bytes" : "");
+    }
+}
+
+
+struct toolchain_data *label_to_toolchain(char *s) {
+    for (int ix = 0;  (ix < NUM_TOOLCHAINS);  ix++) {
+        if (!strcasecmp(s, toolchains[ix].label)) {
+            return &(toolchains[ix]);
+        }
+    }
+    return NULL;
+}
+
+
+void write_toolchain_docker_file(struct toolchain_data *t) {
+    char dir[1024];
+    char name[1024];
+    snprintf(dir, sizeof(dir), "%s", output_file_name ? output_file_name : "./");
+    snprintf(name, sizeof(name), "%s/%s.Dockerfile", dirname(dir), t->image);
+    FILE *f = fopen(name, "w");
+    if (!f) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    printf("Writing file: %s\n", name);
+    fprintf(f, "\n# mlcc toolchain: %s\n", t->image);
+    fprintf(f, "# mlcc version: %s: %s\n", version_string, __DATE__);
+    fprintf(f, "# Build with: docker build -t %s -f %s .\n", t->image, name);
+    char *labels[] = { toolchain_base_os, "OS-Utils", t->label };
+    for (int iy = 0;  (iy < 3);  iy++) {
+        for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+            if (!strcasecmp(labels[iy], pkgs[ix].label)) {
+                write_pkg_frag(f, &(pkgs[ix]), pkgs[ix].frag);
+            }
+        }
+    }
+    write_timing_summary(f);
+    // Images using the toolchain link /usr/local/lib64 to lib (see Python*)
+    fprintf(f, "\nRUN mkdir -p %s && cp -a /usr/local/. %s && cd %s && "
+        "if [ -d lib64 ] && [ ! -L lib64 ]; then cp -a lib64/. lib/ && /bin/rm -rf lib64; fi\n\n",
+        t->prefix, t->prefix, t->prefix);
+    fclose(f);
+}
+
+
+void write_toolchain_docker_files() {
+    printf("\n");
+    for (int ix = 0;  (ix < NUM_TOOLCHAINS);  ix++) {
+        if ((num_selected == 0) || selected(toolchains[ix].label)) {
+            write_toolchain_docker_file(&(toolchains[ix]));
+        }
+    }
+}
+
+
+//
+// The build context only needs the paths the selected fragments COPY from
+// (e.g. MLCC_Repos/NVIDIA_PKGS/...), so <Dockerfile>.dockerignore excludes
+// everything else.  Docker (BuildKit) picks up that Dockerfile specific
+// ignore file, which keeps several generated Dockerfiles in one context dir
+// from clobbering each other's .dockerignore.  With -v, the bytes it keeps
+// out of the Dockerfile's dir are tallied, which walks all of that dir.
+//
+
+#define MAX_CONTEXT_PATHS 64
+char *context_paths[MAX_CONTEXT_PATHS];
+int num_context_paths = 0;
+int context_dir_len = 0;
+long long context_total_bytes = 0;
+long long context_sent_bytes = 0;
+char *context_docker_file = NULL;
+
+
+void add_context_path(char *s) {
+    for (int ix = 0;  (ix < num_context_paths);  ix++) {
+        if (!strcmp(s, context_paths[ix])) {
+            return;
+        }
+    }
+    if (num_context_paths < MAX_CONTEXT_PATHS) {
+        context_paths[num_context_paths++] = strdup(s);
+    } else {
+        fprintf(stderr, "Too many COPY paths, ignoring %s\n", s);
+    }
+}
+
+
+void collect_context_paths(char *frag) {
+    char *p = frag;
+    while (p && *p) {
+        while (isspace(*p)) {
+            p++;
+        }
+        char *eol = strchr(p, '\n');
+        int len = eol ? (eol - p) : strlen(p);
+        if (!strncmp(p, "COPY ", 5) && (len < 1024)) {
+            char line[1024];
+            char *args[32];
+            int num_args = 0;
+            int from_stage = 0;
+            char *save = NULL;
+            memcpy(line, p + 5, len - 5);
+            line[len - 5] = '\0';
+            for (char *tok = strtok_r(line, " \t", &save);  (tok && (num_args < 32));  tok = strtok_r(NULL, " \t", &save)) {
+                if (!strncmp(tok, "--from=", 7)) {
+                    // Copies from another image or stage, not the context
+                    from_stage = 1;
+                } else if (strncmp(tok, "--", 2)) {
+                    args[num_args++] = tok;
+                }
+            }
+            if (from_stage) {
+                num_args = 0;
+            }
+            // The last arg is the destination
+            for (int ix = 0;  (ix < num_args - 1);  ix++) {
+                add_context_path(args[ix]);
+            }
+        }
+        p = eol ? (eol + 1) : NULL;
+    }
+}
+
+
+int context_path_included(const char *rel) {
+    char buf[1024];
+    for (int ix = 0;  (ix < num_context_paths);  ix++) {
+        char pattern[1024];
+        snprintf(pattern, sizeof(pattern), "%s", context_paths[ix]);
+        int len = strlen(pattern);
+        if ((len > 1) && (pattern[len - 1] == '/')) {
+            pattern[len - 1] = '\0';
+        }
+        // Check the path and every dir above it, since COPY of a dir takes all of it
+        snprintf(buf, sizeof(buf), "%s", rel);
+        for (;;) {
+            if (!fnmatch(pattern, buf, FNM_PATHNAME)) {
+                return 1;
+            }
+            char *slash = strrchr(buf, '/');
+            if (!slash) {
+                break;
+            }
+            *slash = '\0';
+        }
+    }
+    return 0;
+}
+
+
+int tally_context_file(const char *path, const struct stat *sb, int type, struct FTW *ftwbuf) {
+    if (type == FTW_F) {
+        char *rel = (char *)path + context_dir_len + 1;
+        int len = strlen(context_docker_file);
+        // The Dockerfile and its .dockerignore go to the builder either way
+        if (!strncmp(rel, context_docker_file, len) && (!rel[len] || !strcmp(rel + len, ".dockerignore"))) {
+            return 0;
+        }
+        context_total_bytes += sb->st_size;
+        if (context_path_included(rel)) {
+            context_sent_bytes += sb->st_size;
+        }
+    }
+    return 0;
+}
+
+
+char *size_string(long long n, char *buf, int len) {
+    char *units[] = { "B", "KB", "MB", "GB", "TB" };
+    double size = n;
+    int ix = 0;
+    while ((size >= 1024.0) && (ix < 4)) {
+        size /= 1024.0;
+        ix += 1;
+    }
+    snprintf(buf, len, "%.1f %s", size, units[ix]);
+    return buf;
+}
+
+
+void write_docker_ignore_file() {
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s.dockerignore", output_file_name);
+    FILE *f = fopen(buf, "w");
+    if (!f) {
+        perror(buf);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(f, "# mlcc: the build context only needs what %s COPYs\n", output_file_name);
+    fprintf(f, "*\n");
+    for (int ix = 0;  (ix < num_context_paths);  ix++) {
+        fprintf(f, "!%s\n", context_paths[ix]);
+    }
+    fclose(f);
+    if (quiet || !verbose) {
+        return;
+    }
+    // Report against the dir the Dockerfile went into, which is normally the build context
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s", output_file_name);
+    char *context_dir = dirname(dir);
+    context_dir_len = strlen(context_dir);
+    char name[1024];
+    snprintf(name, sizeof(name), "%s", output_file_name);
+    context_docker_file = basename(name);
+    context_total_bytes = 0;
+    context_sent_bytes = 0;
+    if (nftw(context_dir, tally_context_file, 16, FTW_PHYS) == 0) {
+        char sent[32], total[32], saved[32];
+        printf("Build context %s: sends %s of %s, %s excluded by %s\n\n", context_dir,
+            size_string(context_sent_bytes, sent, sizeof(sent)),
+            size_string(context_total_bytes, total, sizeof(total)),
+            size_string(context_total_bytes - context_sent_bytes, saved, sizeof(saved)), buf);
+    }
+}
+
+
+//
+// With --apptainer, the Dockerfile text is also translated into an Apptainer
+// (Singularity) definition file next to it, for HPC nodes without a Docker
+// daemon.  "apptainer build" turns it into a single squashfs SIF each node
+// mounts, rather than layers to pull and extract.  The translation:
+//
+//     FROM x [AS s]    a stage bootstrapped from docker://x (Stage: s)
+//     ARG N[=v]        export N="${N:-v}" in %post
+//     ENV ...          export ... in %post and %environment
+//     RUN ...          /bin/sh -c '...' in %post, so each still starts afresh
+//     COPY [--from=s]  %files [from s], dir sources copy their contents
+//     EXPOSE, LABEL    %labels
+//     CMD              %runscript
+//
+// Apptainer copies %files ahead of %post, so a COPY lands before any RUN of
+// its stage.  COPY --from an image rather than a stage (the -T toolchains)
+// gets a stage bootstrapped from the local docker-daemon image.
+//
+
+enum { DEF_FILES, DEF_LABELS, DEF_ENVIRONMENT, DEF_POST, DEF_RUNSCRIPT, NUM_DEF_SECTIONS };
+char *def_section_names[NUM_DEF_SECTIONS] = { NULL, "labels", "environment", "post", "runscript" };
+
+#define MAX_DEF_STAGES 16
+struct def_stage_data {
+    char *bootstrap;
+    char from[256];
+    char name[128];
+    char expose[256];
+    FILE *f[NUM_DEF_SECTIONS];
+    char *text[NUM_DEF_SECTIONS];
+    size_t len[NUM_DEF_SECTIONS];
+} def_stages[MAX_DEF_STAGES];
+int num_def_stages = 0;
+
+
+struct def_stage_data *add_def_stage(char *bootstrap, char *from, char *name) {
+    if (num_def_stages >= MAX_DEF_STAGES) {
+        fprintf(stderr, "Too many stages for %s.def\n", output_file_name);
+        exit(EXIT_FAILURE);
+    }
+    struct def_stage_data *d = &(def_stages[num_def_stages++]);
+    d->bootstrap = bootstrap;
+    snprintf(d->from, sizeof(d->from), "%s", from);
+    snprintf(d->name, sizeof(d->name), "%s", name);
+    d->expose[0] = '\0';
+    for (int ix = 0;  (ix < NUM_DEF_SECTIONS);  ix++) {
+        d->text[ix] = NULL;
+        d->f[ix] = open_memstream(&(d->text[ix]), &(d->len[ix]));
+    }
+    return d;
+}
+
+
+struct def_stage_data *find_def_stage(char *name) {
+    for (int ix = 0;  (ix < num_def_stages);  ix++) {
+        if (!strcmp(def_stages[ix].name, name)) {
+            return &(def_stages[ix]);
+        }
+    }
+    return NULL;
+}
+
+
+void write_def_stage(FILE *f, struct def_stage_data *d) {
+    fprintf(f, "\nBootstrap: %s\nFrom: %s\n", d->bootstrap, d->from);
+    if (d->name[0]) {
+        fprintf(f, "Stage: %s\n", d->name);
+    }
+    if (d->expose[0]) {
+        fprintf(d->f[DEF_LABELS], "    mlcc.expose%s\n", d->expose);
+    }
+    for (int ix = 0;  (ix < NUM_DEF_SECTIONS);  ix++) {
+        fclose(d->f[ix]);
+        if (d->len[ix] > 0) {
+            if (def_section_names[ix]) {
+                fprintf(f, "\n%%%s\n", def_section_names[ix]);
+            }
+            if (ix == DEF_POST) {
+                fprintf(f, "    set -e\n");
+            }
+            fputs(d->text[ix], f);
+        }
+        free(d->text[ix]);
+    }
+}
+
+
+void translate_def_copy(struct def_stage_data *d, char *args) {
+    char *words[32];
+    int num_words = 0;
+    char *from = NULL;
+    char *save = NULL;
+    for (char *tok = strtok_r(args, " \t", &save);  (tok && (num_words < 32));  tok = strtok_r(NULL, " \t", &save)) {
+        if (!strncmp(tok, "--from=", 7)) {
+            from = tok + 7;
+        } else if (strncmp(tok, "--", 2)) {
+            words[num_words++] = tok;
+        }
+    }
+    if (num_words < 2) {
+        return;
+    }
+    if (from && !find_def_stage(from)) {
+        char image[256];
+        snprintf(image, sizeof(image), "%s:latest", from);
+        add_def_stage("docker-daemon", image, from);
+    }
+    FILE *f = d->f[DEF_FILES];
+    fprintf(f, from ? "\n%%files from %s\n" : "\n%%files\n", from);
+    for (int ix = 0;  (ix < num_words - 1);  ix++) {
+        char *src = words[ix];
+        char *base = strrchr(src, '/');
+        base = base ? base + 1 : src;
+        if (!*base) {
+            fprintf(f, "    %s* %s\n", src, words[num_words - 1]);
+        } else if (strpbrk(base, "*?[.")) {
+            fprintf(f, "    %s %s\n", src, words[num_words - 1]);
+        } else {
+            fprintf(f, "    %s/* %s\n", src, words[num_words - 1]);
+        }
+    }
+}
+
+
+void translate_def_line(struct def_stage_data *d, char *line) {
+    char *args = strchr(line, ' ');
+    if (!args) {
+        return;
+    }
+    *args++ = '\0';
+    if (!strcmp(line, "ARG")) {
+        char *eq = strchr(args, '=');
+        if (eq) {
+            fprintf(d->f[DEF_POST], "    export %.*s=${%.*s:-%s}\n", (int)(eq - args), args, (int)(eq - args), args, eq + 1);
+        } else {
+            fprintf(d->f[DEF_POST], "    export %s\n", args);
+        }
+    } else if (!strcmp(line, "ENV")) {
+        char *sp = strchr(args, ' ');
+        char *eq = strchr(args, '=');
+        for (int ix = DEF_ENVIRONMENT;  (ix <= DEF_POST);  ix++) {
+            if (sp && (!eq || (sp < eq))) {
+                fprintf(d->f[ix], "    export %.*s=\"%s\"\n", (int)(sp - args), args, sp + 1);
+            } else {
+                fprintf(d->f[ix], "    export %s\n", args);
+            }
+        }
+    } else if (!strcmp(line, "RUN")) {
+        fprintf(d->f[DEF_POST], "    /bin/sh -c '");
+        for (char *c = args;  *c;  c++) {
+            if (*c == '\'') {
+                fputs("'\\''", d->f[DEF_POST]);
+            } else {
+                fputc(*c, d->f[DEF_POST]);
+            }
+        }
+        fprintf(d->f[DEF_POST], "'\n");
+    } else if (!strcmp(line, "COPY")) {
+        translate_def_copy(d, args);
+    } else if (!strcmp(line, "EXPOSE")) {
+        int len = strlen(d->expose);
+        snprintf(d->expose + len, sizeof(d->expose) - len, " %s", args);
+    } else if (!strcmp(line, "LABEL")) {
+        char *eq = strchr(args, '=');
+        if (eq) {
+            *eq = ' ';
+        }
+        fprintf(d->f[DEF_LABELS], "    %s\n", args);
+    } else if (!strcmp(line, "CMD")) {
+        fprintf(d->f[DEF_RUNSCRIPT], "    exec ");
+        if (*args == '[') {
+            // ["a", "b"]
+            for (char *c = args;  *c;  c++) {
+                if (!strchr("[]\",", *c)) {
+                    fputc(*c, d->f[DEF_RUNSCRIPT]);
+                }
+            }
+        } else {
+            fprintf(d->f[DEF_RUNSCRIPT], "%s", args);
+        }
+        fprintf(d->f[DEF_RUNSCRIPT], " \"$@\"\n");
+    } else {
+        fprintf(d->f[DEF_POST], "    # %s %s has no Apptainer equivalent\n", line, args);
+    }
+}
+
+
+void write_apptainer_def_file(char *dockerfile) {
+    char name[1024];
+    snprintf(name, sizeof(name), "%s.def", output_file_name);
+    FILE *f = fopen(name, "w");
+    if (!f) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    printf("Writing file: %s\n\n", name);
+    num_def_stages = 0;
+    struct def_stage_data *d = NULL;
+    for (char *line = dockerfile;  *line;  ) {
+        char *eol = strchr(line, '\n');
+        int len = eol ? (eol - line) : strlen(line);
+        if (line[0] == '#') {
+            // The # mlcc header comments
+            if (!d) {
+                fprintf(f, "%.*s\n", len, line);
+            }
+        } else if (len > 0) {
+            char *buf = strndup(line, len);
+            for (char *end = buf + len;  ((end > buf) && isspace(end[-1]));  end--) {
+                end[-1] = '\0';
+            }
+            if (!strncmp(buf, "FROM ", 5)) {
+                char *as = strstr(buf, " AS ");
+                if (as) {
+                    *as = '\0';
+                }
+                d = add_def_stage("docker", buf + 5, as ? as + 4 : "");
+            } else if (d) {
+                translate_def_line(d, buf);
+            }
+            free(buf);
+        }
+        line += eol ? (len + 1) : len;
+    }
+    fprintf(f, "# Build with: apptainer build --fakeroot %s.sif %s\n", output_file_name, name);
+    // Stages from images first, then those from the Dockerfile in order
+    for (int ix = 0;  (ix < num_def_stages);  ix++) {
+        if (!strcmp(def_stages[ix].bootstrap, "docker-daemon")) {
+            write_def_stage(f, &(def_stages[ix]));
+        }
+    }
+    for (int ix = 0;  (ix < num_def_stages);  ix++) {
+        if (strcmp(def_stages[ix].bootstrap, "docker-daemon")) {
+            if ((num_def_stages > 1) && !def_stages[ix].name[0]) {
+                snprintf(def_stages[ix].name, sizeof(def_stages[ix].name), "mlcc-final");
+            }
+            write_def_stage(f, &(def_stages[ix]));
+        }
+    }
+    fprintf(f, "\n");
+    fclose(f);
+}
+
+
+//
+// With --lazy-pull, <output>.build.sh builds and pushes the image in a
+// format nodes can start from before the pull finishes, fetching files as
+// they are read.  For eStargz, the image is then optimized with
+// mlcc_prefetch as the entrypoint, so the files the import checks touched
+// are ordered first in each layer and fetched up front.  zstd:chunked has no
+// such ordering, so there mlcc_prefetch is the image's ENTRYPOINT, reading
+// them in the background as the container starts.
+//
+
+void write_lazy_pull_build_script() {
+    char name[1024];
+    snprintf(name, sizeof(name), "%s.build.sh", output_file_name);
+    FILE *f = fopen(name, "w");
+    if (!f) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    printf("Writing file: %s\n\n", name);
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s", output_file_name);
+    char *dockerfile = basename(dir);
+    fprintf(f, "#!/bin/bash\n");
+    fprintf(f, "# mlcc --lazy-pull %s build of %s\n", lazy_pull, dockerfile);
+    fprintf(f, "set -e\n");
+    fprintf(f, "IMAGE=\"${1:?usage: $0 <registry>/<image>:<tag>}\"\n");
+    fprintf(f, "cd \"$(dirname \"$0\")\"\n");
+    if (!strcmp(lazy_pull, "estargz")) {
+        fprintf(f, "docker buildx build -f %s -t \"$IMAGE-unoptimized\" "
+            "--output type=registry,oci-mediatypes=true,compression=estargz,force-compression=true .\n", dockerfile);
+        fprintf(f, "ctr-remote image pull \"$IMAGE-unoptimized\"\n");
+        fprintf(f, "ctr-remote image optimize --oci --entrypoint='[ \"/usr/local/bin/mlcc_prefetch\" ]' --args='[]' "
+            "\"$IMAGE-unoptimized\" \"$IMAGE\"\n");
+        fprintf(f, "ctr-remote image push \"$IMAGE\"\n");
+    } else {
+        fprintf(f, "podman build -f %s -t \"$IMAGE\" .\n", dockerfile);
+        fprintf(f, "podman push --compression-format zstd:chunked --force-compression \"$IMAGE\"\n");
+    }
+    fclose(f);
+    chmod(name, 0755);
+}
+
+
+void set_lazy_pull(char *s) {
+    if (!strcasecmp(s, "estargz")) {
+        lazy_pull = "estargz";
+    } else if (!strcasecmp(s, "zstd:chunked") || !strcasecmp(s, "zstd-chunked")) {
+        lazy_pull = "zstd:chunked";
+    } else {
+        fprintf(stderr, "Unknown lazy pull format %s, expecting estargz or zstd:chunked\n", s);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+// Where each pkg, and then the final frags, start in the Dockerfile text
+struct frag_span_data {
+    char *label;
+    size_t start;
+} frag_spans[MAX_PKGS + 1];
+int num_frag_spans = 0;
+
+
+void write_selected_pkg(FILE *f, struct pkg_data *p, char *stage) {
+    if (debug) {
+        printf("Including (%d) %s: %s\n", (int)(p - pkgs), p->label, p->desc);
+    }
+    char *frag = p->frag;
+    if (toolchain_images && label_to_toolchain(p->label)) {
+        frag = label_to_toolchain(p->label)->frag;
+    }
+    char from[256];
+    if (stage && !strncmp(frag, "FROM ", 5)) {
+        snprintf(from, sizeof(from), "%s AS %s", frag, stage);
+        frag = from;
+    }
+    frag_spans[num_frag_spans].label = p->label;
+    frag_spans[num_frag_spans++].start = ftell(f);
+    write_pkg_frag(f, p, frag);
+    collect_context_paths(frag);
+}
+
+
+//
+// With --stages, each selected pkg of stages[] builds in a stage of its own,
+// and BuildKit runs the stages that do not depend on each other at the same
+// time, rather than all the builds going one after another in one line of
+// layers.  mlcc-base is the OS with its repos and utils and the accelerator.
+// A toolchain stage builds on mlcc-base alone.  A component stage writes its
+// needs ahead of it, the selected pkgs that check_compatibility_and_add()
+// pulls in for it, as in the linear build.  It does not see the other
+// selected components, which the linear build may have installed ahead of
+// it.  It COPYs in just the selected toolchains that its frag and those of
+// its needs use (going by the toolchain's uses words), so it waits for only
+// those.  Each stage ends with mlcc_stage.sh collecting the
+// files it changed into /opt/mlcc-stage, and the final stage COPYs all of
+// those onto mlcc-base ahead of the other pkgs.  The build then takes about
+// as long as its longest chain of stages.  The rpm database stays that of
+// mlcc-base, and -m only times the pkgs outside of stages.
+//
+
+#define GCC_STAGE_ENV "ENV CC=\"/usr/local/bin/gcc\" CXX=\"/usr/local/bin/g++\""
+
+struct stage_data {
+    char *label;
+    char *uses;   // for a toolchain, words in a frag that mean it is needed
+    char *env;    // what the final stage needs of it beyond its files
+} stages[] = {
+{ "CMake", "cmake", NULL },
+{ "Python2", "python,pip ", NULL },
+{ "Python3", "python,pip ", NULL },
+{ "GCC-5.3", "make,gcc", GCC_STAGE_ENV },
+{ "GCC-5.5", "make,gcc", GCC_STAGE_ENV },
+{ "GCC-6.3", "make,gcc", GCC_STAGE_ENV },
+{ "GCC-6.4", "make,gcc", GCC_STAGE_ENV },
+{ "GCC-7.3", "make,gcc", GCC_STAGE_ENV },
+{ "Bazel", "bazel", NULL },
+{ "MKL-DNN", NULL, NULL },
+{ "Theano", NULL, NULL },
+{ "Caffe2", NULL, NULL },
+{ "Paddle", NULL, NULL },
+};
+#define NUM_STAGES (sizeof(stages) / sizeof(stages[0]))
+int concurrent_stages = 0;
+
+char *stage_helper_frag = BS( RUN
+cd /usr/local && if [ ! -e lib64 ]; then ln -s lib lib64; fi;
+echo -e '\
+#!/bin/bash \n\
+if [ "$1" == "start" ]; then \n\
+    touch /tmp/mlcc_stage.stamp \n\
+    exit 0 \n\
+fi \n\
+mkdir -p /opt/mlcc-stage && cd / \n\
+find / -xdev -path /proc -prune -o -path /sys -prune -o -path /dev -prune -o -path /run -prune \
+    -o -path /tmp -prune -o -path /var/tmp -prune -o -path /var/cache -prune -o -path /var/log -prune \
+    -o -path /var/lib/rpm -prune -o -path /var/lib/yum -prune -o -path /var/lib/dnf -prune \
+    -o -path /root/.cache -prune -o -path /opt/mlcc-stage -prune -o -path /etc/mlcc/build-stamps -prune \
+    -o -path /etc/hosts -prune -o -path /etc/hostname -prune -o -path /etc/resolv.conf -prune \
+    -o -path /etc/ld.so.cache -prune -o ! -type d -cnewer /tmp/mlcc_stage.stamp -print0 | \
+    xargs -0 -r cp -a --parents -t /opt/mlcc-stage \n\
+echo "$2: $(du -sh /opt/mlcc-stage | cut -f1) to merge" \n'
+>> /tmp/mlcc_stage.sh;
+chmod +x /tmp/mlcc_stage.sh
+);
+
+
+struct stage_data *staged(struct pkg_data *p) {
+    if (!p->include || (toolchain_images && label_to_toolchain(p->label))) {
+        return NULL;
+    }
+    for (int ix = 0;  (ix < NUM_STAGES);  ix++) {
+        if (!strcasecmp(p->label, stages[ix].label)) {
+            return &(stages[ix]);
+        }
+    }
+    return NULL;
+}
+
+
+int in_base_stage(struct pkg_data *p) {
+    return p->include && !staged(p)
+        && ((p->po_num < MISC_LO_PO_NUM_START) || (toolchain_images && label_to_toolchain(p->label)));
+}
+
+
+void stage_name(char *buf, int len, char *label) {
+    snprintf(buf, len, "mlcc-stage-%s", label);
+    for (char *c = buf;  *c;  c++) {
+        *c = tolower(*c);
+    }
+}
+
+
+int frag_uses(char *frag, char *words) {
+    char buf[256];
+    char *save = NULL;
+    snprintf(buf, sizeof(buf), "%s", words);
+    for (char *w = strtok_r(buf, ",", &save);  w;  w = strtok_r(NULL, ",", &save)) {
+        if (strstr(frag, w)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// Adds the component alone to the OS, accelerator and Python selected, and
+// puts the selection back, noting the selected pkgs it pulled in
+void find_stage_needs(struct pkg_data *p, char *needs) {
+    int was[MAX_PKGS];
+    int was_num_selected = num_selected;
+    int was_num_changed = num_changed_pkgs;
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        was[ix] = pkgs[ix].include;
+        if (pkgs[ix].po_num >= MISC_LO_PO_NUM_START) {
+            pkgs[ix].include = 0;
+        }
+    }
+    check_compatibility_and_add(p->label);
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        needs[ix] = was[ix] && pkgs[ix].include && (pkgs[ix].po_num >= MISC_LO_PO_NUM_START)
+            && strcasecmp(pkgs[ix].label, p->label) && !staged(&(pkgs[ix]));
+        pkgs[ix].include = was[ix];
+    }
+    for (int ix = was_num_changed;  (ix < num_changed_pkgs);  ix++) {
+        pkg_changed[changed_pkgs[ix]] = 0;
+    }
+    num_changed_pkgs = was_num_changed;
+    num_selected = was_num_selected;
+}
+
+
+// An ARG ends with its stage, so those of mlcc-base are declared again
+void write_stage_from(FILE *f, char *from, char *name, char *args) {
+    fprintf(f, "\nFROM %s%s%s\n%s", from, name ? " AS " : "", name ? name : "", args);
+}
+
+
+void write_concurrent_stages(FILE *f) {
+    char name[256];
+    char *base = NULL;
+    size_t base_len = 0;
+    long base_start = ftell(f);
+    int first_span = num_frag_spans;
+    FILE *m = open_memstream(&base, &base_len);
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if (in_base_stage(&(pkgs[ix]))) {
+            write_selected_pkg(m, &(pkgs[ix]), "mlcc-base");
+        }
+    }
+    fclose(m);
+    for (int ix = first_span;  (ix < num_frag_spans);  ix++) {
+        frag_spans[ix].start += base_start;
+    }
+    fputs(base, f);
+    char *args = NULL;
+    size_t args_len = 0;
+    FILE *a = open_memstream(&args, &args_len);
+    for (char *line = base;  (*line);  line += strcspn(line, "\n"), line += (*line == '\n')) {
+        line += strspn(line, " \t");
+        int len = strcspn(line, "\n");
+        while ((len > 0) && isspace(line[len - 1])) {
+            len -= 1;
+        }
+        if (!strncmp(line, "ARG ", 4)) {
+            fprintf(a, "%.*s\n", len, line);
+        }
+    }
+    fclose(a);
+    free(base);
+    fprintf(f, "\n%s\n", stage_helper_frag);
+    // The toolchains, and then the components
+    for (int pass = 0;  (pass < 2);  pass++) {
+        for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+            struct stage_data *s = staged(&(pkgs[ix]));
+            if (!s || ((pass == 0) != (s->uses != NULL))) {
+                continue;
+            }
+            stage_name(name, sizeof(name), pkgs[ix].label);
+            write_stage_from(f, "mlcc-base", name, args);
+            char needs[MAX_PKGS] = { 0 };
+            if (pass == 1) {
+                find_stage_needs(&(pkgs[ix]), needs);
+            }
+            for (int iy = 0;  (pass == 1) && (iy < NUM_PKGS);  iy++) {
+                struct stage_data *t = staged(&(pkgs[iy]));
+                if (!t || !t->uses) {
+                    continue;
+                }
+                int uses = frag_uses(pkgs[ix].frag, t->uses);
+                for (int iz = 0;  (iz < NUM_PKGS);  iz++) {
+                    uses |= (needs[iz] && frag_uses(pkgs[iz].frag, t->uses));
+                }
+                if (uses) {
+                    char tool[256];
+                    stage_name(tool, sizeof(tool), pkgs[iy].label);
+                    fprintf(f, "COPY --from=%s /opt/mlcc-stage/ /\n", tool);
+                    if (t->env) {
+                        fprintf(f, "%s\n", t->env);
+                    }
+                }
+            }
+            if (pass == 1) {
+                fprintf(f, "RUN ldconfig\n");
+                // Written again in the final stage, with their import checks
+                int checks = num_import_checks;
+                for (int iz = 0;  (iz < NUM_PKGS);  iz++) {
+                    if (needs[iz]) {
+                        write_pkg_frag(f, &(pkgs[iz]), pkgs[iz].frag);
+                    }
+                }
+                num_import_checks = checks;
+            }
+            fprintf(f, "RUN /tmp/mlcc_stage.sh start\n");
+            write_selected_pkg(f, &(pkgs[ix]), NULL);
+            fprintf(f, "RUN /tmp/mlcc_stage.sh collect %s\n", pkgs[ix].label);
+        }
+    }
+    write_stage_from(f, "mlcc-base", inference ? "mlcc-build" : NULL, args);
+    free(args);
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if (staged(&(pkgs[ix]))) {
+            stage_name(name, sizeof(name), pkgs[ix].label);
+            fprintf(f, "COPY --from=%s /opt/mlcc-stage/ /\n", name);
+        }
+    }
+    fprintf(f, "RUN ldconfig\n");
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        struct stage_data *s = staged(&(pkgs[ix]));
+        if (s && s->env) {
+            fprintf(f, "%s\n", s->env);
+        }
+    }
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if (pkgs[ix].include && !staged(&(pkgs[ix])) && !in_base_stage(&(pkgs[ix]))) {
+            write_selected_pkg(f, &(pkgs[ix]), NULL);
+        }
+    }
+}
+
+
+//
+// The "# mlcc options:" header line records the options that change the
+// Dockerfile, those not at their default, in one canonical spelling, so that
+// --regen can apply them again.
+//
+
+void write_option_arg(FILE *f, char *s) {
+    if (*s && !strpbrk(s, " \t\"\\")) {
+        fprintf(f, " %s", s);
+        return;
+    }
+    fprintf(f, " \"");
+    for (char *p = s;  (*p);  p++) {
+        if ((*p == '"') || (*p == '\\')) {
+            fputc('\\', f);
+        }
+        fputc(*p, f);
+    }
+    fprintf(f, "\"");
+}
+
+
+void write_options(FILE *f) {
+    if (apptainer) {
+        fprintf(f, " --apptainer");
+    }
+    for (int ix = 0;  (ix < num_catalogs);  ix++) {
+        fprintf(f, " --catalog");
+        write_option_arg(f, catalogs[ix].path);
+    }
+    if (cpu_arch) {
+        fprintf(f, " --cpu-arch");
+        write_option_arg(f, cpu_arch);
+    }
+    if (cuda_archs_given) {
+        char archs[MAX_CUDA_ARCHS * 8] = "";
+        for (int ix = 0;  (ix < num_cuda_archs);  ix++) {
+            snprintf(archs + strlen(archs), sizeof(archs) - strlen(archs), "%s%d.%d", ix ? "," : "", cuda_archs[ix] / 10, cuda_archs[ix] % 10);
+        }
+        fprintf(f, " --cuda-arch");
+        write_option_arg(f, archs);
+    }
+    if (!cuda_ptx) {
+        fprintf(f, " --cuda-ptx no");
+    }
+    if (import_budget_ms) {
+        fprintf(f, " --import-budget %d", import_budget_ms);
+    }
+    if (inference) {
+        fprintf(f, " --inference");
+    }
+    if (lazy_pull) {
+        fprintf(f, " --lazy-pull %s", lazy_pull);
+    }
+    if (python_profile_task) {
+        fprintf(f, " --python-pgo-task");
+        write_option_arg(f, python_profile_task);
+    }
+    if (python_profile != &(python_profiles[0])) {
+        fprintf(f, " --python-profile %s", python_profile->name);
+    }
+    if (slim) {
+        fprintf(f, " --slim");
+    }
+    if (concurrent_stages) {
+        fprintf(f, " --stages");
+    }
+    if (tf_verbs) {
+        fprintf(f, " --tf-verbs");
+    }
+    if (tf_xla) {
+        fprintf(f, " --tf-xla");
+    }
+    if (gcc_profile != &(gcc_profiles[0])) {
+        fprintf(f, " -g %s", gcc_profile->name);
+    }
+    if (timing) {
+        fprintf(f, " -m");
+    }
+    if (toolchain_images) {
+        fprintf(f, " -T");
+    }
+}
+
+
+char *options_text() {
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *f = open_memstream(&text, &text_len);
+    write_options(f);
+    fclose(f);
+    return text;
+}
+
+
+char *docker_file_text() {
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *f = open_memstream(&text, &text_len);
+    // FIXME: just make the mlcc command a comment for now...
+    // fprintf(f, "\nLABEL mlcc_command=\"mlcc -i ");
+    fprintf(f, "\n# mlcc -i ");
+    num_context_paths = 0;
+    num_selected = 0;
+    num_import_checks = 0;
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        if (pkgs[ix].include == 1) {
+            add_to_set(&(pkgs[ix]), selected_set, &num_selected);
+        }
+    }
+    sort_set_by_label_and_remove_duplicates(selected_set, &num_selected);
+    sort_set_by_po_num(selected_set, &num_selected);
+    int need_comma = 0;
+    for (int ix = 0;  (ix < num_selected);  ix++) {
+        if (need_comma) {
+            fprintf(f, ",");
+        }
+        fprintf(f, "%s", selected_set[ix]->label);
+        need_comma = 1;
+    }
+    // fprintf(f, "\"\n");
+    fprintf(f, "\n# mlcc options:");
+    write_options(f);
+    fprintf(f, "\n# mlcc version: %s: %s\n", version_string, __DATE__);
+    num_frag_spans = 0;
+    if (concurrent_stages) {
+        write_concurrent_stages(f);
+    } else {
+        for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+            if (pkgs[ix].include) {
+                write_selected_pkg(f, &(pkgs[ix]), inference ? "mlcc-build" : NULL);
+            }
+        }
+    }
+    frag_spans[num_frag_spans].label = "(final)";
+    frag_spans[num_frag_spans++].start = ftell(f);
+    fprintf(f, "\n%s\n", python_final_frag);
+    write_import_checks(f);
+    write_prefetch_helper(f);
+    write_timing_summary(f);
+    write_inference_stage(f);
+    fprintf(f, "\n");
+    fclose(f);
+    return text;
+}
+
+
+void write_docker_file(char *text) {
+    FILE *out = fopen(output_file_name, "w");
+    if (!out) {
+        perror(output_file_name);
+        exit(EXIT_FAILURE);
+    }
+    fputs(text, out);
+    fclose(out);
+    write_docker_ignore_file();
+    if (apptainer) {
+        write_apptainer_def_file(text);
+    }
+    if (lazy_pull) {
+        write_lazy_pull_build_script();
+    }
+}
+
+
+void write_docker_file_contents() {
+    if (!output_file_name) {
+        time_t t = time(NULL);
+        struct tm *tmp = localtime(&t);
+        if (tmp == NULL) {
+            perror("localtime");
+            exit(EXIT_FAILURE);
+        }
+        static char buf[127];
+        strftime(buf, 127, "%Y%m%d%H%M%S_Dockerfile", tmp);
+        output_file_name = buf;
+    }
+    printf("\nWriting file: %s\n\n", output_file_name);
+    char *text = docker_file_text();
+    write_docker_file(text);
+    free(text);
+}
+
+
+void complete_selections() {
+    // Must always select an OS
+    if (!selected_strn("RHEL", 4) && !selected_strn("Centos", 6) && !selected_strn("Fedora", 6)) {
+        mark_selection("RHEL7.2", 1);
+        mark_selection("OS-Utils", 2);
+        mark_selection("CMake", 2);
+    }
+    // Must always select one of the Python versions
+    if (!selected_strn("Python", 6)) {
+        // FIXME: following conditional is OK until RHEL starts using Python3 as system python
+        if (selected_strn("Fedora", 6)) {
+            mark_selection("Python3", 1);
+        } else {
+            mark_selection("Python2", 1);
+        }
+    }
+    // Must always select either CPU or CUDA
+    if (!selected_strn("CUDA", 4) && !selected("CPU")) {
+        mark_selection("CPU", 1);
+    }
+    // An inference image needs something to serve with
+    if (inference && !selected("TF-Serving") && !selected("ONNX-Runtime")) {
+        check_compatibility_and_add("TF-Serving");
+        check_compatibility_and_add("ONNX-Runtime");
+    }
+    // Once the accelerator is settled, whatever order it was picked in
+    check_dali_accelerator();
+}
+
+
+//
+// Rough build minutes of the pkgs that take real time to build, for
+// balancing --shard.  Anything not listed counts as 1.  The -m build-times
+// of a real build are the place to refine these from.
+//
+
+struct pkg_cost_data {
+    char *label;
+    int minutes;
+} pkg_costs[] = {
+{ "OS-Utils", 2 }, { "CMake", 3 },
+{ "CUDA8.0", 6 }, { "CUDA9.0", 6 }, { "CUDA9.1", 6 }, { "CUDA9.2", 6 },
+{ "Python2", 12 }, { "Python3", 12 },
+{ "GCC-5.3", 45 }, { "GCC-5.5", 45 }, { "GCC-6.3", 45 }, { "GCC-6.4", 45 }, { "GCC-7.3", 45 },
+{ "MKL", 3 }, { "MKL-DNN", 8 }, { "OpenBLAS", 6 }, { "Atlas", 4 }, { "Numpy", 2 },
+{ "OpenMPI", 8 }, { "Bazel", 2 }, { "TensorFlow", 90 }, { "Digits", 5 }, { "Scipy", 3 },
+{ "OpenCV-src", 30 }, { "Mxnet", 3 }, { "CuPy", 10 }, { "PyTorch", 3 }, { "PyTorch-src", 60 },
+{ "Horovod", 8 }, { "Julia", 5 }, { "Octave", 5 }, { "R", 8 }, { "R-studio", 4 },
+{ "CNTK", 5 }, { "Caffe", 25 }, { "Caffe2", 45 }, { "cutorch", 10 }, { "Torch", 30 },
+{ "Pillow-SIMD", 4 }, { "TF-Serving", 80 }, { "ONNX-Runtime", 40 },
+};
+#define NUM_PKG_COSTS (sizeof(pkg_costs) / sizeof(pkg_costs[0]))
+
+
+int pkg_cost(char *label) {
+    for (int ix = 0;  (ix < NUM_PKG_COSTS);  ix++) {
+        if (!strcasecmp(label, pkg_costs[ix].label)) {
+            return pkg_costs[ix].minutes;
+        }
+    }
+    return 1;
+}
+
+
+//
+// --batch <file> writes a Dockerfile for each line of the file, each line a
+// -i style list of pkgs, into the -o dir.  With --shard i/N, only those of
+// shard i (1..N) are written.  The plan is a longest processing time first
+// pass over the images, costliest first, putting each where the shard load
+// ends up least.  An image's OS, accelerator and Python pkgs are its shared
+// prefix, which costs nothing on a shard already building that prefix, so
+// images sharing a base tend to land together and reuse its layers.  Ties
+// go by name and then the lower shard, so every host computes the same plan.
+// Lines resolving to the same pkgs as an earlier one are dropped, so no two
+// shards write the same file.  A name too long to keep whole is cut short and
+// ends with a hash of the pkgs, so it still names just the one selection.
+//
+
+#define MAX_BATCH 1024
+#define MAX_SHARDS 1024
+struct batch_data {
+    char *line;
+    char *selection;
+    char name[256];
+    char prefix[256];
+    int prefix_cost;
+    int suffix_cost;
+    int shard;
+} batch[MAX_BATCH];
+int num_batch = 0;
+
+
+void select_batch_line(char *line) {
+    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+        set_pkg_include(ix, 0);
+    }
+    num_selected = 0;
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", line);
+    for (char *p = strtok(buf, list_delimiters);  p;  p = strtok(NULL, list_delimiters)) {
+        check_compatibility_and_add(p);
+    }
+    if (num_selected > 0) {
+        complete_selections();
+    }
+}
+
+
+int compare_batch_cost(const void *a, const void *b) {
+    struct batch_data *x = *(struct batch_data **)a;
+    struct batch_data *y = *(struct batch_data **)b;
+    int cost = (y->prefix_cost + y->suffix_cost) - (x->prefix_cost + x->suffix_cost);
+    if (cost) {
+        return cost;
+    }
+    // Then by name, and by line for repeats
+    int name = strcmp(x->name, y->name);
+    return name ? name : (x - y);
+}
+
+
+void plan_batch_shards(int num_shards) {
+    int load[MAX_SHARDS];
+    struct batch_data *order[MAX_BATCH];
+    for (int ix = 0;  (ix < num_shards);  ix++) {
+        load[ix] = 0;
+    }
+    for (int ix = 0;  (ix < num_batch);  ix++) {
+        order[ix] = &(batch[ix]);
+        order[ix]->shard = -1;
+    }
+    qsort(order, num_batch, sizeof(order[0]), compare_batch_cost);
+    for (int ix = 0;  (ix < num_batch);  ix++) {
+        struct batch_data *b = order[ix];
+        int best = -1;
+        int best_load = 0;
+        for (int shard = 0;  (shard < num_shards);  shard++) {
+            int has_prefix = 0;
+            for (int iy = 0;  (iy < ix);  iy++) {
+                if ((order[iy]->shard == shard) && !strcmp(order[iy]->prefix, b->prefix)) {
+                    has_prefix = 1;
+                    break;
+                }
+            }
+            int new_load = load[shard] + b->suffix_cost + (has_prefix ? 0 : b->prefix_cost);
+            if ((best < 0) || (new_load < best_load)) {
+                best = shard;
+                best_load = new_load;
+            }
+        }
+        b->shard = best;
+        load[best] = best_load;
+    }
+    if (!quiet) {
+        for (int shard = 0;  (shard < num_shards);  shard++) {
+            printf("Shard %d/%d: ~%d minutes\n", shard + 1, num_shards, load[shard]);
+            for (int ix = 0;  (ix < num_batch);  ix++) {
+                if (batch[ix].shard == shard) {
+                    printf("    %-60s %4d + %d\n", batch[ix].name, batch[ix].prefix_cost, batch[ix].suffix_cost);
+                }
+            }
+        }
+    }
+}
+
+
+void write_batch_docker_files() {
+    FILE *f = fopen(batch_file, "r");
+    if (!f) {
+        perror(batch_file);
+        exit(EXIT_FAILURE);
+    }
+    char *dir = output_file_name ? output_file_name : ".";
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "#\n")] = '\0';
+        if (strspn(line, list_delimiters) == strlen(line)) {
+            continue;
+        }
+        if (num_batch >= MAX_BATCH) {
+            fprintf(stderr, "More than %d lines in %s\n", MAX_BATCH, batch_file);
+            exit(EXIT_FAILURE);
+        }
+        struct batch_data *b = &(batch[num_batch]);
+        select_batch_line(line);
+        if (num_selected == 0) {
+            fprintf(stderr, "No known pkgs in line \"%s\" of %s\n", line, batch_file);
+            exit(EXIT_FAILURE);
+        }
+        char name[4096];
+        char selection[4096] = "";
+        int len = snprintf(name, sizeof(name), "%s/mlcc", dir);
+        b->prefix[0] = '\0';
+        b->prefix_cost = 0;
+        b->suffix_cost = 0;
+        for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
+            // Once for the OS and its repos, which share a label
+            if ((pkgs[ix].include == 1) && (label_to_po_num(pkgs[ix].label) == pkgs[ix].po_num)) {
+                len += snprintf(name + len, (len < sizeof(name)) ? sizeof(name) - len : 0, "-%s", pkgs[ix].label);
+                int n = strlen(selection);
+                snprintf(selection + n, sizeof(selection) - n, "%s,", pkgs[ix].label);
+            }
+            if (pkgs[ix].include && (pkgs[ix].po_num < MISC_LO_PO_NUM_START)) {
+                int n = strlen(b->prefix);
+                snprintf(b->prefix + n, sizeof(b->prefix) - n, "%s,", pkgs[ix].label);
+                b->prefix_cost += pkg_cost(pkgs[ix].label);
+            } else if (pkgs[ix].include) {
+                b->suffix_cost += pkg_cost(pkgs[ix].label);
+            }
+        }
+        for (char *c = strrchr(name, '/') + 1;  *c;  c++) {
+            *c = tolower(*c);
+        }
+        if ((len + strlen(".Dockerfile")) < sizeof(b->name)) {
+            strcpy(b->name, name);
+            strcat(b->name, ".Dockerfile");
+        } else {
+            int keep = sizeof(b->name) - strlen("-01234567.Dockerfile") - 1;
+            if (keep < (strlen(dir) + strlen("/mlcc-"))) {
+                fprintf(stderr, "No room for Dockerfile names under %s\n", dir);
+                exit(EXIT_FAILURE);
+            }
+            snprintf(b->name, sizeof(b->name), "%.*s-%08x.Dockerfile", keep, name, hash_label(selection));
+        }
+        int repeat = -1;
+        for (int ix = 0;  (ix < num_batch) && (repeat < 0);  ix++) {
+            repeat = strcmp(batch[ix].selection, selection) ? -1 : ix;
+        }
+        if (repeat >= 0) {
+            if (!quiet) {
+                printf("Skipping \"%s\", the same pkgs as \"%s\"\n", line, batch[repeat].line);
+            }
+            continue;
         }
+        b->line = strdup(line);
+        b->selection = strdup(selection);
+        num_batch++;
+    }
+    fclose(f);
+    plan_batch_shards(shard_count);
+    for (int ix = 0;  (ix < num_batch);  ix++) {
+        if (batch[ix].shard != (shard_index - 1)) {
+            continue;
+        }
+        select_batch_line(batch[ix].line);
+        output_file_name = batch[ix].name;
+        if (toolchain_images) {
+            write_toolchain_docker_files();
+        }
+        write_docker_file_contents();
     }
-    return -1;
 }
 
 
-int selected(char *s) {
-    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
-        if (!strcasecmp(s, pkgs[ix].label)) {
-            return pkgs[ix].include;
-        }
+#define CUDA_ARCH_OPT 1000
+#define CUDA_PTX_OPT  1001
+#define TF_XLA_OPT    1002
+#define CPU_ARCH_OPT  1003
+#define TF_VERBS_OPT  1004
+#define INFERENCE_OPT 1005
+#define PYTHON_PGO_TASK_OPT 1006
+#define PYTHON_PROFILE_OPT  1007
+#define IMPORT_BUDGET_OPT   1008
+#define SLIM_OPT            1009
+#define APPTAINER_OPT       1010
+#define LAZY_PULL_OPT       1011
+#define BATCH_OPT           1012
+#define SHARD_OPT           1013
+#define CATALOG_OPT         1014
+#define REGEN_OPT           1015
+#define STAGES_OPT          1016
+
+struct option long_options[] = {
+    { "cpu-arch", required_argument, NULL, CPU_ARCH_OPT },
+    { "cuda-arch", required_argument, NULL, CUDA_ARCH_OPT },
+    { "cuda-ptx", required_argument, NULL, CUDA_PTX_OPT },
+    { "import-budget", required_argument, NULL, IMPORT_BUDGET_OPT },
+    { "inference", no_argument, NULL, INFERENCE_OPT },
+    { "lazy-pull", required_argument, NULL, LAZY_PULL_OPT },
+    { "python-pgo-task", required_argument, NULL, PYTHON_PGO_TASK_OPT },
+    { "python-profile", required_argument, NULL, PYTHON_PROFILE_OPT },
+    { "apptainer", no_argument, NULL, APPTAINER_OPT },
+    { "batch", required_argument, NULL, BATCH_OPT },
+    { "catalog", required_argument, NULL, CATALOG_OPT },
+    { "regen", no_argument, NULL, REGEN_OPT },
+    { "shard", required_argument, NULL, SHARD_OPT },
+    { "stages", no_argument, NULL, STAGES_OPT },
+    { "slim", no_argument, NULL, SLIM_OPT },
+    { "tf-verbs", no_argument, NULL, TF_VERBS_OPT },
+    { "tf-xla", no_argument, NULL, TF_XLA_OPT },
+    { "debug", no_argument, NULL, 'd' },
+    { "fetch", no_argument, NULL, 'F' },
+    { "gcc-profile", required_argument, NULL, 'g' },
+    { "gui", no_argument, NULL, 'G' },
+    { "help", no_argument, NULL, 'h' },
+    { "include", required_argument, NULL, 'i' },
+    { "interactive", no_argument, NULL, 'I' },
+    { "list", no_argument, NULL, 'l' },
+    { "manifest", no_argument, NULL, 'M' },
+    { "timing", no_argument, NULL, 'm' },
+    { "output", required_argument, NULL, 'o' },
+    { "quiet", no_argument, NULL, 'q' },
+    { "title", required_argument, NULL, 't' },
+    { "toolchains", no_argument, NULL, 'T' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "version", no_argument, NULL, 'V' },
+    { NULL, 0, NULL, 0 }
+};
+
+
+int set_recorded_option(int opt, char *arg) {
+    switch (opt) {
+        case CPU_ARCH_OPT: cpu_arch = arg; break;
+        case CUDA_ARCH_OPT: set_cuda_archs(arg); break;
+        case CUDA_PTX_OPT: set_cuda_ptx(arg); break;
+        case IMPORT_BUDGET_OPT: import_budget_ms = atoi(arg); break;
+        case INFERENCE_OPT: inference = 1; break;
+        case LAZY_PULL_OPT: set_lazy_pull(arg); break;
+        case PYTHON_PGO_TASK_OPT: python_profile_task = arg; break;
+        case PYTHON_PROFILE_OPT: set_python_profile(arg); break;
+        case APPTAINER_OPT: apptainer = 1; break;
+        case SLIM_OPT: slim = 1; break;
+        case STAGES_OPT: concurrent_stages = 1; break;
+        case TF_VERBS_OPT: tf_verbs = 1; break;
+        case TF_XLA_OPT: tf_xla = 1; break;
+        case 'g': set_gcc_profile(arg); break;
+        case 'm': timing = 1; break;
+        case 'T': toolchain_images = 1; break;
+        default: return 0;
     }
-    return 0;
+    return 1;
 }
 
 
-int selected_strn(char *s, int n) {
-    int result = 0;
-    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
-        if (!strncasecmp(s, pkgs[ix].label, n)) {
-            result |= pkgs[ix].include;
-        }
-    }
-    return result;
+void reset_recorded_options() {
+    int default_cuda_archs[] = DEFAULT_CUDA_ARCHS;
+    apptainer = 0;
+    cpu_arch = NULL;
+    memcpy(cuda_archs, default_cuda_archs, sizeof(default_cuda_archs));
+    num_cuda_archs = sizeof(default_cuda_archs) / sizeof(default_cuda_archs[0]);
+    cuda_archs_given = 0;
+    cuda_ptx = 1;
+    import_budget_ms = 0;
+    inference = 0;
+    lazy_pull = NULL;
+    python_profile_task = NULL;
+    python_profile = &(python_profiles[0]);
+    slim = 0;
+    concurrent_stages = 0;
+    tf_verbs = 0;
+    tf_xla = 0;
+    gcc_profile = &(gcc_profiles[0]);
+    timing = 0;
+    toolchain_images = 0;
 }
 
 
-void check_compatibility_and_add(char *s) {
-    int po_num = label_to_po_num(s);
-    if ((po_num >= 0) && (po_num < MISC_LO_PO_NUM_START)) {
-        clear_all_selections_in_po_num_group(po_num);
-    }
-    if (!strncasecmp(s, "spaCy", 5)) {
-        mark_selection("Thinc", 2);
+// The recorded options given on the command line, and the catalogs (of
+// --catalog and $MLCC_CATALOG), for --regen
+#define MAX_GIVEN_OPTIONS 64
+struct given_option_data {
+    int opt;
+    char *arg;
+} given_options[MAX_GIVEN_OPTIONS];
+int num_given_options = 0;
+char *given_catalogs[MAX_CATALOGS];
+int num_given_catalogs = 0;
+
+
+int apply_given_options() {
+    for (int ix = 0;  (ix < num_given_catalogs);  ix++) {
+        load_catalog(given_catalogs[ix]);
     }
-    if (!strncasecmp(s, "R-studio", 8)) {
-        mark_selection("R", 2);
+    for (int ix = 0;  (ix < num_given_options);  ix++) {
+        set_recorded_option(given_options[ix].opt, given_options[ix].arg);
     }
-    if ((!strncasecmp(s, "Caffe", 5)
-        || (!strncasecmp(s, "Caffe2", 6)))) {
-        mark_selection("Numpy", 2);
-        mark_selection("Atlas", 2);
-        mark_selection("OpenBLAS", 2);
+    return num_given_options + num_given_catalogs;
+}
+
+
+// Split the "# mlcc options:" line as a shell would, and apply it
+int apply_options_line(char *name, char *line) {
+    char *buf = strndup(line, strcspn(line, "\n"));
+    char *argv[MAX_GIVEN_OPTIONS + 2] = { "mlcc" };
+    int argc = 1;
+    char *p = buf;
+    while (*p) {
+        if (isspace(*p)) {
+            p++;
+            continue;
+        }
+        if (argc > MAX_GIVEN_OPTIONS) {
+            printf("%s: too many \"# mlcc options\"\n", name);
+            return 1;
+        }
+        char *q = p;
+        argv[argc++] = q;
+        int quoted = 0;
+        while (*p && (quoted || !isspace(*p))) {
+            if (*p == '"') {
+                quoted = !quoted;
+            } else if ((*p == '\\') && p[1]) {
+                *q++ = *++p;
+            } else {
+                *q++ = *p;
+            }
+            p++;
+        }
+        if (*p) {
+            p++;
+        }
+        *q = '\0';
     }
-    if (!strncasecmp(s, "CNTK", 4)) {
-        mark_selection("Numpy", 2);
-        mark_selection("Scipy", 2);
+    argv[argc] = NULL;
+    int opt;
+    int failed = 0;
+    opterr = 0;
+    optind = 0;
+    while (!failed && ((opt = getopt_long(argc, argv, "g:mT", long_options, NULL)) != -1)) {
+        if ((opt == CATALOG_OPT) && access(optarg, R_OK)) {
+            printf("%s: catalog %s: %s\n", name, optarg, strerror(errno));
+            failed = 1;
+        } else if (opt == CATALOG_OPT) {
+            load_catalog(optarg);
+        } else if (!set_recorded_option(opt, optarg)) {
+            printf("%s: unexpected \"# mlcc options\" %s\n", name, argv[optind - 1]);
+            failed = 1;
+        }
     }
-    if (!strncasecmp(s, "TensorFlow", 10)) {
-        mark_selection("Numpy", 2);
+    opterr = 1;
+    if (failed) {
+        return 1;
     }
-    if (!strncasecmp(s, "Paddle", 6)) {
-        mark_selection("Numpy", 2);
+    if (optind < argc) {
+        printf("%s: unexpected \"# mlcc options\" %s\n", name, argv[optind]);
+        return 1;
     }
-    if ((!strncasecmp(s, "Scikit", 6)
-        || (!strncasecmp(s, "Theano", 6)))) {
-        mark_selection("Numpy", 2);
-        mark_selection("Scipy", 2);
-        mark_selection("Cython", 2);
+    return 0;
+}
+
+
+//
+// --regen <Dockerfile>... writes each Dockerfile again from its "# mlcc -i"
+// pkgs and "# mlcc options", catalogs included, with the frags of this mlcc.
+// Options given along with --regen may repeat recorded ones, but not change
+// them, and only apply as such to files from before the "# mlcc options"
+// line.  A file with a pkg that is not there (say its catalog is gone) is
+// left alone.  The
+// files are spread over a process per cpu.  A file is only rewritten when
+// more than its "# mlcc version" line would change, and then the pkgs
+// whose frags changed are listed.  Those are found by walking the new frags
+// along the old file, picking up at the next frag found after one that is
+// not.
+//
+
+int regen_docker_file(char *name) {
+    char *old = NULL;
+    size_t old_len = 0;
+    FILE *f = fopen(name, "r");
+    if (!f || (getdelim(&old, &old_len, '\0', f) < 0)) {
+        printf("%s: %s\n", name, strerror(f ? EINVAL : errno));
+        return 1;
     }
-    if (!strncasecmp(s, "Seaborn", 7)) {
-        mark_selection("Numpy", 2);
-        mark_selection("Scipy", 2);
-        mark_selection("Pandas", 2);
-        mark_selection("Matplotlib", 2);
+    fclose(f);
+    char *labels = strstr(old, "# mlcc -i ");
+    char *old_version = strstr(old, "\n# mlcc version: ");
+    if (!labels || !old_version) {
+        printf("%s: no \"# mlcc -i\" and \"# mlcc version\" header\n", name);
+        free(old);
+        return 1;
     }
-    if ((!strncasecmp(s, "R-studio", 8))
-        || (!strncasecmp(s, "Spyder", 6))
-        || (!strncasecmp(s, "Octave", 6))
-        || (!strncasecmp(s, "Matplotlib", 10))
-        || (!strncasecmp(s, "Seaborn", 7))) {
-        mark_selection("VNC", 2);
+    reset_recorded_options();
+    unload_catalogs();
+    char *options = strstr(old, "\n# mlcc options:");
+    if (options && (options < old_version)) {
+        if (apply_options_line(name, options + strlen("\n# mlcc options:"))) {
+            free(old);
+            return 1;
+        }
+        char *recorded = options_text();
+        char *given = (apply_given_options() ? options_text() : NULL);
+        if (given && strcmp(given, recorded)) {
+            printf("%s: options conflict with its \"# mlcc options:%s\"\n", name, recorded);
+            free(given);
+            free(recorded);
+            free(old);
+            return 1;
+        }
+        free(given);
+        free(recorded);
+    } else {
+        apply_given_options();
     }
-    mark_selection(s, 1);
-    if (selected_strn("CUDA", 4)) {
-        if (selected("Chainer") || selected("spaCy") || selected("Thinc")) {
-            mark_selection("CuPy", 2);
+    labels += strlen("# mlcc -i ");
+    char line[1024];
+    snprintf(line, sizeof(line), "%.*s", (int)strcspn(labels, "\n"), labels);
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", line);
+    for (char *p = strtok(buf, list_delimiters);  p;  p = strtok(NULL, list_delimiters)) {
+        if (label_to_po_num(p) < 0) {
+            printf("%s: no pkg %s, of its \"# mlcc -i\" header\n", name, p);
+            free(old);
+            return 1;
         }
     }
-    if ( selected_strn("RHEL", 4) || selected_strn("Centos", 6) || selected_strn("Fedora", 6) ) {
-        mark_selection("OS-Utils", 2);
+    select_batch_line(line);
+    if (num_selected == 0) {
+        printf("%s: no pkgs in \"# mlcc -i\" header\n", name);
+        free(old);
+        return 1;
     }
-    if (selected_strn("Fedora", 6)) {
-        // CUDA needs older GCC compilers:
-        // - CUDA8.0 needs GCC 5 or older
-        // - CUDA9.0 needs GCC 6 or older
-        // - CUDA9.1 needs GCC 6 or older
-        // - CUDA9.2 needs GCC 7 or older
-        if (selected("CUDA8.0")) {
-            mark_selection("GCC-5.5", 2);
-        } else if (selected("CUDA9.0") || selected("CUDA9.1")) {
-            if (!selected("Fedora25")) {
-                // Could use GCC 6 here, if working. Wait for GCC6.5?
-                mark_selection("GCC-5.5", 2);
-            }
-        } else if (selected("CUDA9.2")) {
-            if (selected("Fedora28")) {
-                mark_selection("GCC-7.3", 2);
+    output_file_name = name;
+    char *text = docker_file_text();
+    char *new_version = strstr(text, "\n# mlcc version: ");
+    char *old_rest = strchr(old_version + 1, '\n');
+    char *new_rest = strchr(new_version + 1, '\n');
+    old_rest = old_rest ? old_rest + 1 : "";
+    if (((old_version - old) == (new_version - text)) && !strncmp(old, text, old_version - old)
+        && !strcmp(old_rest, new_rest + 1)) {
+        printf("%s: unchanged\n", name);
+        free(text);
+        free(old);
+        return 0;
+    }
+    size_t text_len = strlen(text);
+    char *cursor = old_rest;
+    int num_changed = 0;
+    char *last_changed = NULL;
+    printf("%s: changed", name);
+    for (int ix = 0;  (ix < num_frag_spans);  ix++) {
+        char *frag = text + frag_spans[ix].start;
+        size_t len = ((ix + 1) < num_frag_spans) ? frag_spans[ix + 1].start - frag_spans[ix].start : text_len - frag_spans[ix].start;
+        if (!strncmp(cursor, frag, len)) {
+            cursor += len;
+            continue;
+        }
+        // The OS and its repos share a label
+        if (!last_changed || strcmp(frag_spans[ix].label, last_changed)) {
+            printf(" %s", frag_spans[ix].label);
+        }
+        last_changed = frag_spans[ix].label;
+        num_changed++;
+        for (int iy = ix + 1;  (iy < num_frag_spans);  iy++) {
+            size_t next_len = ((iy + 1) < num_frag_spans) ? frag_spans[iy + 1].start - frag_spans[iy].start : text_len - frag_spans[iy].start;
+            char *next = memmem(cursor, strlen(cursor), text + frag_spans[iy].start, next_len);
+            if (next) {
+                cursor = next;
+                break;
             }
         }
     }
-    if ( selected("Jupyter") && selected("R") ) {
-        mark_selection("IRkernel", 2);
+    if (num_changed == 0) {
+        // Only the "# mlcc -i" line, or a frag gone from the end
+        int same_header = ((old_version - old) == (new_version - text)) && !strncmp(old, text, old_version - old);
+        printf(" %s", (same_header ? frag_spans[num_frag_spans - 1].label : "(header)"));
     }
+    printf("\n");
+    write_docker_file(text);
+    free(text);
+    free(old);
+    return 0;
 }
 
 
-#ifdef GUI
-
-
-#include <gtk/gtk.h>
-#include <glib.h>
-
-int num_buttons = 0;
-int first_other_button = 0;
-GtkWidget *buttons[NUM_PKGS];
-GtkWidget *save_rhel72_button = NULL;
-GtkWidget *save_cpu_button = NULL;
-GtkWidget *save_python2_button = NULL;
-
-void handle_select_event(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
-    char *button_label = (char *)gtk_button_get_label(GTK_BUTTON(widget));
-    if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
-        check_compatibility_and_add(button_label);
-        for (int ix = first_other_button;  (ix < num_buttons);  ix++) {
-            int selected_state = (selected((char *)gtk_button_get_label(GTK_BUTTON(buttons[ix]))) > 0);
-            gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(buttons[ix]), selected_state);
-        }
-    } else {
-        mark_selection((char *)button_label, 0);
+int regen_docker_files(int num_files, char **files) {
+    if (num_files == 0) {
+        fprintf(stderr, "Expecting --regen <Dockerfile>...\n");
+        return EXIT_FAILURE;
     }
-}
-
-void add_button(GtkWidget *b) {
-    buttons[num_buttons++] = b;
-    g_signal_connect(b, "clicked", G_CALLBACK(handle_select_event), NULL);
-}
-
-void handle_reset_event(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(save_rhel72_button), 1);
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(save_cpu_button), 1);
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(save_python2_button), 1);
-    for (int ix = first_other_button;  (ix < num_buttons);  ix++) {
-        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(buttons[ix]), 0);
-        mark_selection((char *)gtk_button_get_label(GTK_BUTTON(buttons[ix])), 0);
+    int num_workers = (num_cpus < num_files) ? num_cpus : num_files;
+    if (num_workers < 1) {
+        num_workers = 1;
     }
-}
-
-static gboolean handle_create_button(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
-    for (int ix = 0;  (ix < num_buttons);  ix++) {
-        if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(buttons[ix]))) {
-            check_compatibility_and_add((char *)gtk_button_get_label(GTK_BUTTON(buttons[ix])));
+    // Not the tally of what each .dockerignore leaves in the context
+    quiet = 1;
+    for (int ix = 0;  (ix < num_catalogs);  ix++) {
+        given_catalogs[num_given_catalogs++] = strdup(catalogs[ix].path);
+    }
+    fflush(stdout);
+    for (int worker = 0;  (worker < num_workers);  worker++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+        }
+        if (pid == 0) {
+            int failed = 0;
+            for (int ix = worker;  (ix < num_files);  ix += num_workers) {
+                failed |= regen_docker_file(files[ix]);
+                // A line per file, so workers do not interleave mid line
+                fflush(stdout);
+            }
+            exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
         }
     }
-    gtk_main_quit();
-    return(FALSE);
-} 
-
-static gboolean handle_destroy_event(GtkWidget *widget, GdkEventExpose *event, gpointer data) {
-    gtk_main_quit();
-    exit(EXIT_SUCCESS);
+    int result = EXIT_SUCCESS;
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+            result = EXIT_FAILURE;
+        }
+    }
+    return result;
 }
 
 
-void make_gui_choices() {
-
-    GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
-    gtk_window_set_title(GTK_WINDOW(window), title_string);
-    gtk_window_set_position(GTK_WINDOW(window), GTK_WIN_POS_CENTER);
-    g_signal_connect(G_OBJECT(window), "destroy", G_CALLBACK(handle_destroy_event), NULL);
-    // gtk_window_set_decorated(GTK_WINDOW(window), show_window_decorations);
-    // gtk_window_set_default_size(GTK_WINDOW(window), panel_width, panel_height);
-    // gtk_container_set_border_width(GTK_CONTAINER(window), 10);
-
-    GtkWidget *big_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
-    gtk_box_set_homogeneous(GTK_BOX(big_box), FALSE);
-    gtk_container_add(GTK_CONTAINER(window), big_box);
-
-    GtkWidget *os_box1 = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    gtk_box_pack_start(GTK_BOX(big_box), os_box1, TRUE, TRUE, 0);
-    GtkWidget *button = gtk_radio_button_new_with_label(NULL, "RHEL7.2");
-    add_button(button);
-    save_rhel72_button = button;
-    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "RHEL7.3");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "RHEL7.4");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "RHEL7.5");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Centos7");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(os_box1), button, TRUE, FALSE, 2);
+void set_shard(char *s) {
+    if ((sscanf(s, "%d/%d", &shard_index, &shard_count) != 2)
+        || (shard_count < 1) || (shard_count > MAX_SHARDS) || (shard_index < 1) || (shard_index > shard_count)) {
+        fprintf(stderr, "Expecting --shard i/N with 1 <= i <= N <= %d, not %s\n", MAX_SHARDS, s);
+        exit(EXIT_FAILURE);
+    }
+}
 
-    GtkWidget *os_box2 = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    gtk_box_pack_start(GTK_BOX(big_box), os_box2, TRUE, TRUE, 0);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Fedora25");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(os_box2), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Fedora26");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(os_box2), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Fedora27");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(os_box2), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Fedora28");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(os_box2), button, TRUE, FALSE, 2);
 
-    GtkWidget *separator = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
-    gtk_box_pack_start(GTK_BOX(big_box), separator, FALSE, TRUE, 0);
+//
+// "mlcc build <Dockerfile>..." builds the given Dockerfiles, at most -j at a
+// time, each once the Dockerfiles whose images it uses (FROM or COPY --from,
+// e.g. the -T toolchains) have built.  The image built from foo.Dockerfile
+// (or foo) is named foo, lower cased.  A new build also waits while the 1
+// minute load average is at or above --load (default the number of CPUs), or
+// there is less than --memory GB (default 4) available, unless nothing else
+// is running.  The output of each goes to <logs>/<image>.log, and unless -q,
+// to stdout with the image name in front of each line.  A failed build skips
+// what depends on it, and what depends on that.  At the end it prints the start and duration of each,
+// and the critical path, the chain of dependent builds taking the longest.
+//
+// The builder is a shell command run with MLCC_IMAGE, MLCC_DOCKERFILE and
+// MLCC_CONTEXT (--context, default the working dir, where MLCC_Repos is)
+// set, either that of a builders[] entry or given as is, like "sleep 1; echo
+// $MLCC_IMAGE" to try out a plan.
+//
 
-    GtkWidget *accel_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    gtk_box_pack_start(GTK_BOX(big_box), accel_box, TRUE, TRUE, 0);
-    button = gtk_radio_button_new_with_label(NULL, "CPU");
-    add_button(button);
-    save_cpu_button = button;
-    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "CUDA8.0");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "CUDA9.0");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "CUDA9.1");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "CUDA9.2");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(accel_box), button, TRUE, FALSE, 2);
+struct builder_data {
+    char *name;
+    char *command;
+} builders[] = {
+{ "docker", "docker build -t \"$MLCC_IMAGE\" -f \"$MLCC_DOCKERFILE\" \"$MLCC_CONTEXT\"" },
+{ "podman", "podman build -t \"$MLCC_IMAGE\" -f \"$MLCC_DOCKERFILE\" \"$MLCC_CONTEXT\"" },
+{ "buildah", "buildah bud -t \"$MLCC_IMAGE\" -f \"$MLCC_DOCKERFILE\" \"$MLCC_CONTEXT\"" },
+};
+#define NUM_BUILDERS (sizeof(builders) / sizeof(builders[0]))
+
+enum { BUILD_WAITING, BUILD_RUNNING, BUILD_DONE, BUILD_FAILED, BUILD_SKIPPED };
+char *build_states[] = { "waiting", "running", "done", "FAILED", "skipped" };
+
+#define MAX_BUILDS 256
+#define MAX_BUILD_DEPS 32
+struct build_data {
+    char *file;
+    char image[256];
+    char context[1024];
+    int deps[MAX_BUILD_DEPS];
+    int num_deps;
+    int state;
+    pid_t pid;
+    int fd;
+    FILE *log;
+    char line[1024];
+    int line_len;
+    double start;
+    double end;
+} builds[MAX_BUILDS];
+int num_builds = 0;
+
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
 
-    separator = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
-    gtk_box_pack_start(GTK_BOX(big_box), separator, FALSE, TRUE, 0);
 
-    GtkWidget *python_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    gtk_box_pack_start(GTK_BOX(big_box), python_box, TRUE, TRUE, 0);
-    button = gtk_radio_button_new_with_label(NULL, "Python2");
-    add_button(button);
-    save_python2_button = button;
-    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button), TRUE);
-    gtk_box_pack_start(GTK_BOX(python_box), button, TRUE, FALSE, 2);
-    button = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(button), "Python3");
-    add_button(button);
-    gtk_box_pack_start(GTK_BOX(python_box), button, TRUE, FALSE, 2);
+double load_average() {
+    double load = 0.0;
+    FILE *f = fopen("/proc/loadavg", "r");
+    if (f) {
+        if (fscanf(f, "%lf", &load) != 1) {
+            load = 0.0;
+        }
+        fclose(f);
+    }
+    return load;
+}
 
-    separator = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
-    gtk_box_pack_start(GTK_BOX(big_box), separator, FALSE, TRUE, 0);
 
-    GtkWidget *other_box = gtk_flow_box_new();
-    gtk_flow_box_set_min_children_per_line((GtkFlowBox *)other_box, 3);
-    gtk_flow_box_set_max_children_per_line((GtkFlowBox *)other_box, 4);
-    gtk_box_pack_start(GTK_BOX(big_box), other_box, TRUE, TRUE, 0);
+double available_memory_gb() {
+    char buf[256];
+    long kb = -1;
+    FILE *f = fopen("/proc/meminfo", "r");
+    if (f) {
+        while (fgets(buf, sizeof(buf), f)) {
+            if (sscanf(buf, "MemAvailable: %ld kB", &kb) == 1) {
+                break;
+            }
+        }
+        fclose(f);
+    }
+    return (kb < 0) ? -1.0 : (kb / (1024.0 * 1024.0));
+}
 
-    num_available = 0;
-    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
-        if (pkgs[ix].po_num >= MISC_LO_PO_NUM_START) {
-            add_to_set(&(pkgs[ix]), available_set, &num_available);
+
+int image_to_build(char *image) {
+    char name[256];
+    snprintf(name, sizeof(name), "%s", image);
+    name[strcspn(name, ":")] = '\0';
+    for (int ix = 0;  (ix < num_builds);  ix++) {
+        if (!strcasecmp(builds[ix].image, name)) {
+            return ix;
         }
     }
-    sort_set_by_label_and_remove_duplicates(available_set, &num_available);
-    first_other_button = num_buttons;
-    for (int ix = 0;  (ix < num_available);  ix++) {
-        GtkWidget *button = gtk_check_button_new_with_label(available_set[ix]->label);
-        add_button(button);
-        gtk_flow_box_insert((GtkFlowBox *)other_box, button, -1);
+    return -1;
+}
+
+
+void add_build(char *file, char *context) {
+    if (num_builds >= MAX_BUILDS) {
+        fprintf(stderr, "More than %d Dockerfiles to build\n", MAX_BUILDS);
+        exit(EXIT_FAILURE);
+    }
+    struct build_data *b = &(builds[num_builds++]);
+    char buf[1024];
+    b->file = file;
+    snprintf(b->context, sizeof(b->context), "%s", context);
+    snprintf(buf, sizeof(buf), "%s", file);
+    snprintf(b->image, sizeof(b->image), "%s", basename(buf));
+    int len = strlen(b->image);
+    if ((len > 11) && !strcmp(b->image + len - 11, ".Dockerfile")) {
+        b->image[len - 11] = '\0';
     }
+    for (char *c = b->image;  *c;  c++) {
+        *c = isalnum(*c) ? tolower(*c) : (strchr("._-", *c) ? *c : '-');
+    }
+    b->num_deps = 0;
+    b->state = BUILD_WAITING;
+    b->fd = -1;
+    b->line_len = 0;
+}
 
-    separator = gtk_separator_new(GTK_ORIENTATION_HORIZONTAL);
-    gtk_box_pack_start(GTK_BOX(big_box), separator, FALSE, TRUE, 0);
 
-    GtkWidget *control_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    gtk_box_pack_start(GTK_BOX(big_box), control_box, TRUE, TRUE, 0);
+void find_build_deps(struct build_data *b) {
+    FILE *f = fopen(b->file, "r");
+    if (!f) {
+        perror(b->file);
+        exit(EXIT_FAILURE);
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        char image[256];
+        char *from = strstr(line, "--from=");
+        if (!strncmp(line, "FROM ", 5)) {
+            sscanf(line + 5, "%255s", image);
+        } else if (!strncmp(line, "COPY ", 5) && from) {
+            sscanf(from + 7, "%255s", image);
+        } else {
+            continue;
+        }
+        int dep = image_to_build(image);
+        if ((dep >= 0) && (&(builds[dep]) != b) && (b->num_deps < MAX_BUILD_DEPS)) {
+            b->deps[b->num_deps++] = dep;
+        }
+    }
+    fclose(f);
+}
 
-    GtkWidget *quit_button = gtk_button_new_with_label("Quit");
-    g_signal_connect(quit_button, "clicked", G_CALLBACK(handle_destroy_event), NULL);
-    gtk_box_pack_start(GTK_BOX(control_box), quit_button, TRUE, FALSE, 2);
 
-    GtkWidget *reset_button = gtk_button_new_with_label("Reset");
-    g_signal_connect(reset_button, "clicked", G_CALLBACK(handle_reset_event), NULL);
-    gtk_box_pack_start(GTK_BOX(control_box), reset_button, TRUE, FALSE, 2);
+void start_build(struct build_data *b, char *command, char *log_dir) {
+    char name[1024];
+    int fds[2];
+    snprintf(name, sizeof(name), "%s/%s.log", log_dir, b->image);
+    b->log = fopen(name, "w");
+    if (!b->log || pipe(fds)) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    b->pid = fork();
+    if (b->pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (b->pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        setenv("MLCC_IMAGE", b->image, 1);
+        setenv("MLCC_DOCKERFILE", b->file, 1);
+        setenv("MLCC_CONTEXT", b->context, 1);
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    b->fd = fds[0];
+    b->state = BUILD_RUNNING;
+    b->start = now_seconds();
+    printf("[%s] building %s, log in %s\n", b->image, b->file, name);
+}
 
-    GtkWidget *create_button = gtk_button_new_with_label("Create Dockerfile");
-    g_signal_connect(create_button, "clicked", G_CALLBACK(handle_create_button), NULL);
-    gtk_box_pack_start(GTK_BOX(control_box), create_button, TRUE, FALSE, 2);
 
-    gtk_widget_show_all(window);
-    gtk_main();
+void stream_build_output(struct build_data *b, char *buf, int len) {
+    fwrite(buf, 1, len, b->log);
+    if (quiet) {
+        return;
+    }
+    for (int ix = 0;  (ix < len);  ix++) {
+        if ((buf[ix] != '\n') && (b->line_len < (sizeof(b->line) - 1))) {
+            b->line[b->line_len++] = buf[ix];
+            continue;
+        }
+        printf("[%s] %.*s\n", b->image, b->line_len, b->line);
+        b->line_len = 0;
+        if (buf[ix] != '\n') {
+            b->line[b->line_len++] = buf[ix];
+        }
+    }
+}
 
+
+void finish_build(struct build_data *b) {
+    int status = 0;
+    if (b->line_len > 0) {
+        stream_build_output(b, "\n", 1);
+    }
+    close(b->fd);
+    b->fd = -1;
+    fclose(b->log);
+    waitpid(b->pid, &status, 0);
+    b->end = now_seconds();
+    b->state = (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? BUILD_DONE : BUILD_FAILED;
+    printf("[%s] %s in %.0fs\n", b->image, build_states[b->state], b->end - b->start);
 }
 
 
-#endif
+double critical_path_seconds(int ix, double *path, int *next) {
+    if (path[ix] >= 0.0) {
+        return path[ix];
+    }
+    double longest = 0.0;
+    next[ix] = -1;
+    for (int iy = 0;  (iy < builds[ix].num_deps);  iy++) {
+        int dep = builds[ix].deps[iy];
+        double seconds = critical_path_seconds(dep, path, next);
+        if (seconds > longest) {
+            longest = seconds;
+            next[ix] = dep;
+        }
+    }
+    path[ix] = longest + (builds[ix].end - builds[ix].start);
+    return path[ix];
+}
 
 
-void make_interactive_choices() {
-    for (;;) {
-        printf("\n");
-        partition_selected();
-        display_set("Selected", selected_set, &num_selected, 0, MAX_PO_NUM_LIMIT);
-        display_set("OS Choices", available_set, &num_available, 0, ACCEL_LO_PO_NUM_START);
-        display_set("Accelerator Choices", available_set, &num_available, ACCEL_LO_PO_NUM_START, ACCEL_HI_PO_NUM_LIMIT);
-        display_set("Python Choices", available_set, &num_available, PYTHON_LO_PO_NUM_START, PYTHON_HI_PO_NUM_LIMIT);
-        display_set("Additional Packages", available_set, &num_available, MISC_LO_PO_NUM_START, MAX_PO_NUM_LIMIT);
-        printf("\n(A)dd, (R)emove, (C)reate Dockerfile, (Q)uit: ");
-        char buf[255]; 
-        char choice = 'A';
-        fgets(buf, 255, stdin);
-        if (!isdigit(buf[0])) {
-            choice = toupper(buf[0]);
-            if (choice == 'Q') {
-                exit(EXIT_FAILURE);
-            } else if (choice == 'C') {
+void write_build_summary(double start) {
+    double path[MAX_BUILDS];
+    int next[MAX_BUILDS];
+    int last = -1;
+    printf("\n%d Dockerfiles in %.0fs:\n", num_builds, now_seconds() - start);
+    for (int ix = 0;  (ix < num_builds);  ix++) {
+        path[ix] = -1.0;
+    }
+    for (int ix = 0;  (ix < num_builds);  ix++) {
+        struct build_data *b = &(builds[ix]);
+        if ((b->state == BUILD_DONE) || (b->state == BUILD_FAILED)) {
+            printf("    %-50s %-8s start %6.0fs, took %6.0fs\n", b->image, build_states[b->state],
+                b->start - start, b->end - b->start);
+            if ((critical_path_seconds(ix, path, next) > 0.0) && ((last < 0) || (path[ix] > path[last]))) {
+                last = ix;
+            }
+        } else {
+            printf("    %-50s %s\n", b->image, build_states[b->state]);
+        }
+    }
+    if (last >= 0) {
+        printf("Critical path, %.0fs:", path[last]);
+        // next[] runs from the last build back to the first
+        int chain[MAX_BUILDS];
+        int num_chain = 0;
+        for (int ix = last;  (ix >= 0);  ix = next[ix]) {
+            chain[num_chain++] = ix;
+        }
+        for (int ix = num_chain - 1;  (ix >= 0);  ix--) {
+            printf(" %s%s", builds[chain[ix]].image, ix ? " ->" : "\n");
+        }
+    }
+}
+
+
+// Skips what waits on a failed or skipped build, until nothing more is
+void skip_failed_builds() {
+    int skipped = 1;
+    while (skipped) {
+        skipped = 0;
+        for (int ix = 0;  (ix < num_builds);  ix++) {
+            struct build_data *b = &(builds[ix]);
+            for (int iy = 0;  (iy < b->num_deps) && (b->state == BUILD_WAITING);  iy++) {
+                int state = builds[b->deps[iy]].state;
+                if ((state == BUILD_FAILED) || (state == BUILD_SKIPPED)) {
+                    b->state = BUILD_SKIPPED;
+                    printf("[%s] skipped, %s did not build\n", b->image, builds[b->deps[iy]].image);
+                    skipped = 1;
+                }
+            }
+        }
+    }
+}
+
+
+int build_main(int argc, char **argv) {
+    static struct option build_options[] = {
+        { "builder", required_argument, NULL, 'b' },
+        { "context", required_argument, NULL, 'C' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "load", required_argument, NULL, 'L' },
+        { "logs", required_argument, NULL, 'l' },
+        { "memory", required_argument, NULL, 'M' },
+        { "quiet", no_argument, NULL, 'q' },
+        { NULL, 0, NULL, 0 }
+    };
+    char *command = builders[0].command;
+    char *context = ".";
+    char *log_dir = "mlcc-build-logs";
+    int max_jobs = 2;
+    double max_load = num_cpus;
+    double min_memory_gb = 4.0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:C:j:l:L:M:q", build_options, NULL)) != -1) {
+        switch (opt) {
+            case 'b': {
+                command = optarg;
+                for (int ix = 0;  (ix < NUM_BUILDERS);  ix++) {
+                    if (!strcasecmp(optarg, builders[ix].name)) {
+                        command = builders[ix].command;
+                    }
+                }
                 break;
-            } else if (choice == 'A') {
-                printf("Enter numbers to add: ");
-            } else if (choice == 'R') {
-                printf("Enter numbers to remove: ");
-            } else {
+            }
+            case 'C': context = optarg; break;
+            case 'j': max_jobs = atoi(optarg); break;
+            case 'l': log_dir = optarg; break;
+            case 'L': max_load = atof(optarg); break;
+            case 'M': min_memory_gb = atof(optarg); break;
+            case 'q': quiet = 1; break;
+            default: display_usage_and_exit(); break;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Expecting Dockerfiles to build\n");
+        display_usage_and_exit();
+    }
+    for (int ix = optind;  (ix < argc);  ix++) {
+        add_build(argv[ix], context);
+    }
+    for (int ix = 0;  (ix < num_builds);  ix++) {
+        find_build_deps(&(builds[ix]));
+    }
+    mkdir(log_dir, 0755);
+    if (max_jobs < 1) {
+        max_jobs = 1;
+    }
+    double start = now_seconds();
+    for (;;) {
+        int running = 0;
+        int waiting = 0;
+        for (int ix = 0;  (ix < num_builds);  ix++) {
+            running += (builds[ix].state == BUILD_RUNNING);
+        }
+        int started = 0;
+        skip_failed_builds();
+        for (int ix = 0;  (ix < num_builds);  ix++) {
+            struct build_data *b = &(builds[ix]);
+            if (b->state != BUILD_WAITING) {
                 continue;
             }
-            fgets(buf, 255, stdin);
+            int ready = 1;
+            for (int iy = 0;  (iy < b->num_deps);  iy++) {
+                ready = ready && (builds[b->deps[iy]].state == BUILD_DONE);
+            }
+            waiting += 1;
+            // One new build per pass, as the load average takes a while to show it
+            double memory_gb = available_memory_gb();
+            if (ready && !started && (running < max_jobs)
+                && ((running == 0) || ((load_average() < max_load) && ((memory_gb < 0.0) || (memory_gb >= min_memory_gb))))) {
+                start_build(b, command, log_dir);
+                running += 1;
+                started = 1;
+            }
         }
-        char *p = strtok(buf, list_delimiters);
-        while (p) {
-            unsigned ix = atoi(p);
-            if ((choice == 'A') && (ix < num_available)) {
-                check_compatibility_and_add(available_set[ix]->label);
-            } else if ((choice == 'R') && (ix < num_selected)) {
-                mark_selection(selected_set[ix]->label, 0);
+        if (running == 0) {
+            if (waiting > 0) {
+                // Only a dependency cycle leaves these
+                for (int ix = 0;  (ix < num_builds);  ix++) {
+                    if (builds[ix].state == BUILD_WAITING) {
+                        builds[ix].state = BUILD_SKIPPED;
+                        printf("[%s] skipped, its dependencies form a cycle\n", builds[ix].image);
+                    }
+                }
             }
-            p = strtok(NULL, list_delimiters);
+            break;
+        }
+        struct pollfd fds[MAX_BUILDS];
+        int which[MAX_BUILDS];
+        int num_fds = 0;
+        for (int ix = 0;  (ix < num_builds);  ix++) {
+            if (builds[ix].state == BUILD_RUNNING) {
+                fds[num_fds].fd = builds[ix].fd;
+                fds[num_fds].events = POLLIN;
+                which[num_fds++] = ix;
+            }
+        }
+        if (poll(fds, num_fds, 1000) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(EXIT_FAILURE);
         }
+        for (int ix = 0;  (ix < num_fds);  ix++) {
+            if (fds[ix].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buf[4096];
+                int len = read(fds[ix].fd, buf, sizeof(buf));
+                if (len > 0) {
+                    stream_build_output(&(builds[which[ix]]), buf, len);
+                } else if ((len == 0) || (errno != EINTR)) {
+                    finish_build(&(builds[which[ix]]));
+                }
+            }
+        }
+        fflush(stdout);
     }
+    write_build_summary(start);
+    for (int ix = 0;  (ix < num_builds);  ix++) {
+        if (builds[ix].state != BUILD_DONE) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
 }
 
 
-void write_docker_file_contents() {
-    if (!output_file_name) {
-        time_t t = time(NULL);
-        struct tm *tmp = localtime(&t);
-        if (tmp == NULL) {
-            perror("localtime");
-            exit(EXIT_FAILURE);
+#ifdef BENCH
+//
+// "make bench" builds this into mlcc_bench, which times resolving and writing
+// the Dockerfile of every pkg alone, every OS x accelerator x Python, and a
+// sample (-n, default 2000) of random OS, accelerator, Python and 1 to 6 misc
+// pkgs, always the same one.  It reports selections/s, p50/p99 latency and
+// peak RSS, then compares a hash of each Dockerfile (less the "# mlcc
+// version" line with the build date) against the golden file given, so a
+// faster check_compatibility_and_add() or write_docker_file_contents() can be
+// shown to write the same output.  -u rewrites the golden file instead, for
+// when the output is meant to change.
+//
+
+#define MAX_BENCH 8192
+char *bench_selections[MAX_BENCH];
+double bench_seconds[MAX_BENCH];
+uint64_t bench_hashes[MAX_BENCH];
+int num_bench = 0;
+
+
+void add_bench_selection(char *s) {
+    if (num_bench < MAX_BENCH) {
+        bench_selections[num_bench++] = strdup(s);
+    }
+}
+
+
+uint64_t hash_docker_file(char *name) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    char line[4096];
+    FILE *f = fopen(name, "r");
+    if (!f) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, "# mlcc version", 14)) {
+            continue;
+        }
+        for (unsigned char *c = (unsigned char *)line;  *c;  c++) {
+            hash = (hash ^ *c) * 1099511628211ULL;
         }
-        char buf[127];
-        strftime(buf, 127, "%Y%m%d%H%M%S_Dockerfile", tmp);
-        output_file_name = buf;
     }
-    FILE *f = fopen(output_file_name, "w");
-    printf("\nWriting file: %s\n\n", output_file_name);
-    // FIXME: just make the mlcc command a comment for now...
-    // fprintf(f, "\nLABEL mlcc_command=\"mlcc -i ");
-    fprintf(f, "\n# mlcc -i ");
-    num_selected = 0;
-    for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
-        if (pkgs[ix].include == 1) {
-            add_to_set(&(pkgs[ix]), selected_set, &num_selected);
+    fclose(f);
+    return hash;
+}
+
+
+int compare_seconds(const void *a, const void *b) {
+    double x = *(double *)a;
+    double y = *(double *)b;
+    return (x > y) - (x < y);
+}
+
+
+void report_bench(FILE *f, char *title, int lo, int hi) {
+    int num = hi - lo;
+    double seconds[MAX_BENCH];
+    double total = 0.0;
+    if (num <= 0) {
+        return;
+    }
+    for (int ix = lo;  (ix < hi);  ix++) {
+        seconds[ix - lo] = bench_seconds[ix];
+        total += bench_seconds[ix];
+    }
+    qsort(seconds, num, sizeof(seconds[0]), compare_seconds);
+    fprintf(f, "%-24s %6d %10.1f/s %9.3f ms p50 %9.3f ms p99\n", title, num, num / total,
+        seconds[num / 2] * 1e3, seconds[(num * 99) / 100] * 1e3);
+}
+
+
+int check_bench_golden(FILE *f, char *golden) {
+    char line[1024];
+    int ix = 0;
+    int changed = 0;
+    FILE *g = fopen(golden, "r");
+    if (!g) {
+        perror(golden);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), g)) {
+        unsigned long long hash;
+        char selection[1024];
+        if (sscanf(line, "%llx %1023[^\n]", &hash, selection) != 2) {
+            continue;
         }
+        if ((ix >= num_bench) || strcmp(selection, bench_selections[ix]) || (hash != bench_hashes[ix])) {
+            if (changed++ < 10) {
+                fprintf(f, "changed: %s\n", selection);
+            }
+        }
+        ix++;
     }
-    sort_set_by_label_and_remove_duplicates(selected_set, &num_selected);
-    sort_set_by_po_num(selected_set, &num_selected);
-    int need_comma = 0;
-    for (int ix = 0;  (ix < num_selected);  ix++) {
-        if (need_comma) {
-            fprintf(f, ",");
+    fclose(g);
+    if (ix != num_bench) {
+        fprintf(f, "%d selections, %s has %d\n", num_bench, golden, ix);
+        changed++;
+    }
+    fprintf(f, "%s: %s\n", golden, changed ? "output CHANGED" : "output unchanged");
+    return changed;
+}
+
+
+int bench_main(int argc, char **argv) {
+    int samples = 2000;
+    int update = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:u")) != -1) {
+        switch (opt) {
+            case 'n': samples = atoi(optarg); break;
+            case 'u': update = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-n <samples>] [-u] [<golden file>]\n", argv[0]);
+                return EXIT_FAILURE;
         }
-        fprintf(f, "%s", selected_set[ix]->label);
-        need_comma = 1;
     }
-    // fprintf(f, "\"\n");
-    fprintf(f, "\n# mlcc version: %s: %s\n", version_string, __DATE__);
+    char *golden = (optind < argc) ? argv[optind] : NULL;
+    char *os[MAX_PKGS], *accel[MAX_PKGS], *python[MAX_PKGS], *misc[MAX_PKGS];
+    int num_os = 0, num_accel = 0, num_python = 0, num_misc = 0;
+    int os_po_num = label_to_po_num("Centos7");
     for (int ix = 0;  (ix < NUM_PKGS);  ix++) {
-        if (pkgs[ix].include) {
-            if (debug) {
-                printf("Including (%d) %s: %s\n", ix, pkgs[ix].label, pkgs[ix].desc);
+        struct pkg_data *p = &(pkgs[ix]);
+        // The OS repos share the OS label
+        if (label_to_po_num(p->label) != p->po_num) {
+            continue;
+        }
+        add_bench_selection(p->label);
+        if (p->po_num == os_po_num) {
+            os[num_os++] = p->label;
+        } else if ((p->po_num >= ACCEL_LO_PO_NUM_START) && (p->po_num < ACCEL_HI_PO_NUM_LIMIT)) {
+            accel[num_accel++] = p->label;
+        } else if ((p->po_num >= PYTHON_LO_PO_NUM_START) && (p->po_num < PYTHON_HI_PO_NUM_LIMIT)) {
+            python[num_python++] = p->label;
+        } else if (p->po_num >= MISC_LO_PO_NUM_START) {
+            misc[num_misc++] = p->label;
+        }
+    }
+    int num_single = num_bench;
+    char buf[1024];
+    for (int ix = 0;  (ix < num_os);  ix++) {
+        for (int iy = 0;  (iy < num_accel);  iy++) {
+            for (int iz = 0;  (iz < num_python);  iz++) {
+                snprintf(buf, sizeof(buf), "%s,%s,%s", os[ix], accel[iy], python[iz]);
+                add_bench_selection(buf);
             }
-            fprintf(f, "\n%s\n", pkgs[ix].frag);
         }
     }
-    fprintf(f, "\n");
-    fclose(f);
+    int num_matrix = num_bench - num_single;
+    srand(1);
+    for (int ix = 0;  (ix < samples);  ix++) {
+        int len = snprintf(buf, sizeof(buf), "%s,%s,%s",
+            os[rand() % num_os], accel[rand() % num_accel], python[rand() % num_python]);
+        for (int iy = 1 + (rand() % 6);  (iy > 0);  iy--) {
+            len += snprintf(buf + len, sizeof(buf) - len, ",%s", misc[rand() % num_misc]);
+        }
+        add_bench_selection(buf);
+    }
+    char dir[] = "/tmp/mlcc_bench.XXXXXX";
+    char name[1024];
+    if (!mkdtemp(dir)) {
+        perror(dir);
+        return EXIT_FAILURE;
+    }
+    snprintf(name, sizeof(name), "%s/Dockerfile", dir);
+    // An empty store, so no sums pinned by an "mlcc -F" here change the output
+    char store[1024];
+    snprintf(store, sizeof(store), "%s/SOURCES", dir);
+    source_dir = store;
+    // Keep the report, but not the "Writing file" of every Dockerfile
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!report || !freopen("/dev/null", "w", stdout)) {
+        perror("stdout");
+        return EXIT_FAILURE;
+    }
+    quiet = 1;
+    for (int ix = 0;  (ix < num_bench);  ix++) {
+        double start = now_seconds();
+        select_batch_line(bench_selections[ix]);
+        output_file_name = name;
+        write_docker_file_contents();
+        bench_seconds[ix] = now_seconds() - start;
+        bench_hashes[ix] = hash_docker_file(name);
+    }
+    snprintf(buf, sizeof(buf), "%s/Dockerfile.dockerignore", dir);
+    unlink(buf);
+    unlink(name);
+    rmdir(dir);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    report_bench(report, "single pkg", 0, num_single);
+    report_bench(report, "OS x accel x Python", num_single, num_single + num_matrix);
+    report_bench(report, "random sample", num_single + num_matrix, num_bench);
+    report_bench(report, "all", 0, num_bench);
+    fprintf(report, "peak RSS %ld KB\n", usage.ru_maxrss);
+    int result = EXIT_SUCCESS;
+    if (update && golden) {
+        FILE *g = fopen(golden, "w");
+        if (!g) {
+            perror(golden);
+            return EXIT_FAILURE;
+        }
+        for (int ix = 0;  (ix < num_bench);  ix++) {
+            fprintf(g, "%016llx %s\n", (unsigned long long)bench_hashes[ix], bench_selections[ix]);
+        }
+        fclose(g);
+        fprintf(report, "wrote %s\n", golden);
+    } else if (golden && check_bench_golden(report, golden)) {
+        result = EXIT_FAILURE;
+    }
+    fclose(report);
+    return result;
 }
+#endif
 
 
 int main(int argc, char **argv) {
     int opt;
     prog_name = argv[0];
+    init_pkgs();
+#ifdef BENCH
+    exit(bench_main(argc, argv));
+#endif
     if (argc == 1) {
-        fprintf(stderr, "Expecting one of { -I | -G | -i <pkg>,<pkg>... }:\n");
+        fprintf(stderr, "Expecting one of { -I | -G | -i <pkg>,<pkg>... | --batch <file> | --regen <file>... | -F | -M | -T }:\n");
         display_usage_and_exit();
     }
     num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
-    while ((opt = getopt(argc, argv, "dGhi:Ilo:qvV")) != -1) {
+    if ((argc > 1) && !strcmp(argv[1], "build")) {
+        exit(build_main(argc - 1, argv + 1));
+    }
+    if ((argc > 1) && !strcmp(argv[1], "catalog")) {
+        exit(catalog_main(argc - 1, argv + 1));
+    }
+    if (getenv("MLCC_CATALOG")) {
+        load_catalogs(getenv("MLCC_CATALOG"));
+    }
+    // Every --catalog first, so -i and the rest see all of their pkgs
+    opterr = 0;
+    while ((opt = getopt_long(argc, argv, "dFg:Ghi:IlmMo:qt:TvV", long_options, NULL)) != -1) {
+        if (opt == CATALOG_OPT) {
+            load_catalog(optarg);
+        }
+    }
+    opterr = 1;
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "dFg:Ghi:IlmMo:qt:TvV", long_options, NULL)) != -1) {
+        if (set_recorded_option(opt, optarg)) {
+            if (num_given_options < MAX_GIVEN_OPTIONS) {
+                given_options[num_given_options].opt = opt;
+                given_options[num_given_options++].arg = optarg;
+            }
+            continue;
+        }
         switch (opt) {
+            case BATCH_OPT: batch_file = optarg; break;
+            case CATALOG_OPT: break;
+            case REGEN_OPT: regen = 1; break;
+            case SHARD_OPT: set_shard(optarg); break;
             case 'd': debug = 1; break;
+            case 'F': fetch = 1; break;
             case 'G': {
 #ifdef GUI
                 gui = 1;
@@ -1717,6 +6318,7 @@ int main(int argc, char **argv) {
                 list_all_packages();
                 break;
             }
+            case 'M': manifest = 1; break;
             case 'o': output_file_name = optarg; break;
             case 'q': quiet = 1; break;
             case 't': title_string = optarg; break;
@@ -1725,6 +6327,9 @@ int main(int argc, char **argv) {
             default: display_usage_and_exit(); break;
         }
     }
+    if (regen) {
+        exit(regen_docker_files(argc - optind, argv + optind));
+    }
     if (argc > optind) {
         fprintf(stderr, "Unexpected arg = %s\n", argv[optind]);
         exit(EXIT_FAILURE);
@@ -1743,23 +6348,22 @@ int main(int argc, char **argv) {
     }
 #endif
     if (num_selected > 0) {
-        // Must always select an OS
-        if (!selected_strn("RHEL", 4) && !selected_strn("Centos", 6) && !selected_strn("Fedora", 6)) {
-            mark_selection("RHEL7.2", 1);
-        }
-        // Must always select one of the Python versions
-        if (!selected_strn("Python", 6)) {
-            // FIXME: following conditional is OK until RHEL starts using Python3 as system python
-            if (selected_strn("Fedora", 6)) {
-                mark_selection("Python3", 1);
-            } else {
-                mark_selection("Python2", 1);
-            }
-        }
-        // Must always select either CPU or CUDA
-        if (!selected_strn("CUDA", 4) && !selected("CPU")) {
-            mark_selection("CPU", 1);
-        }
+        complete_selections();
+    }
+    if (batch_file) {
+        write_batch_docker_files();
+        exit(EXIT_SUCCESS);
+    }
+    if (manifest) {
+        write_source_manifest(stdout);
+    }
+    if (fetch && fetch_sources()) {
+        exit(EXIT_FAILURE);
+    }
+    if (toolchain_images) {
+        write_toolchain_docker_files();
+    }
+    if (num_selected > 0) {
         write_docker_file_contents();
     }
     exit(EXIT_SUCCESS);